@@ -0,0 +1,461 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Audio player over ALSA. Samples are copied from the decoder ring to the mmap'ed ring buffer of the device by
+ * periods, the playing position is taken from snd_pcm_delay.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <libavutil/samplefmt.h>
+
+#include <alsa/asoundlib.h>
+
+#include "log.h"
+#include "decode.h"
+#include "audio_player.h"
+#include "avclock.h"
+#include "trace.h"
+
+#define ALSA_DEF_DEVICE     "default"
+/* Ring buffer length if the latency is not set from the command line */
+#define ALSA_DEF_LATENCY_MS 200
+/* Periods in the ring buffer */
+#define ALSA_PERIODS        4
+#define ALSA_WAIT_MS        100
+
+typedef struct {
+    pthread_t task;
+    pthread_mutex_t lock;
+
+    int pause;
+    int running;
+    /* Pause state applied to the device by the player thread */
+    int paused;
+    /* Buffers of the old position have to be dropped from the device */
+    int flush;
+    int can_pause;
+    int underruns;
+
+    snd_pcm_t *pcm;
+    const char *device;
+    int latency_ms;
+    unsigned int rate;
+    int channels;
+    int frame_size;
+    /* Bytes written at once */
+    int period_bytes;
+
+    demux_ctx_h audio_ctx;
+    /* Master clock of the playback */
+    avclock_h clock;
+} alsa_player_ctx_t;
+
+static snd_pcm_format_t av2alsa(enum AVSampleFormat src_fmt)
+{
+    snd_pcm_format_t dst_fmt = SND_PCM_FORMAT_UNKNOWN;
+
+    switch(src_fmt)
+    {
+    case AV_SAMPLE_FMT_U8:
+        dst_fmt = SND_PCM_FORMAT_U8;
+        break;
+    case AV_SAMPLE_FMT_S16:
+        dst_fmt = SND_PCM_FORMAT_S16_LE;
+        break;
+    case AV_SAMPLE_FMT_S32:
+        dst_fmt = SND_PCM_FORMAT_S32_LE;
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        dst_fmt = SND_PCM_FORMAT_FLOAT_LE;
+        break;
+    default:
+        break;
+    }
+
+    return dst_fmt;
+}
+
+static ret_code_t setup_pcm(alsa_player_ctx_t *ctx, snd_pcm_format_t format)
+{
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_uframes_t buffer_size, period_size;
+    unsigned int buffer_time;
+    int err;
+
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_sw_params_alloca(&sw);
+
+    if ((err = snd_pcm_hw_params_any(ctx->pcm, hw)) < 0)
+        goto Error;
+    if ((err = snd_pcm_hw_params_set_access(ctx->pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0)
+    {
+        DBG_E("Device %s has no mmap access. Use the plug plugin, plug:%s for example\n", ctx->device, ctx->device);
+        goto Error;
+    }
+    if ((err = snd_pcm_hw_params_set_format(ctx->pcm, hw, format)) < 0)
+        goto Error;
+    if ((err = snd_pcm_hw_params_set_channels(ctx->pcm, hw, ctx->channels)) < 0)
+        goto Error;
+    if ((err = snd_pcm_hw_params_set_rate_near(ctx->pcm, hw, &ctx->rate, NULL)) < 0)
+        goto Error;
+    buffer_time = (ctx->latency_ms ? ctx->latency_ms : ALSA_DEF_LATENCY_MS) * 1000;
+    if ((err = snd_pcm_hw_params_set_buffer_time_near(ctx->pcm, hw, &buffer_time, NULL)) < 0)
+        goto Error;
+    if ((err = snd_pcm_hw_params_set_periods(ctx->pcm, hw, ALSA_PERIODS, 0)) < 0)
+        DBG_W("Can not set %d periods: %s\n", ALSA_PERIODS, snd_strerror(err));
+    if ((err = snd_pcm_hw_params(ctx->pcm, hw)) < 0)
+        goto Error;
+
+    snd_pcm_hw_params_get_buffer_size(hw, &buffer_size);
+    snd_pcm_hw_params_get_period_size(hw, &period_size, NULL);
+    ctx->can_pause = snd_pcm_hw_params_can_pause(hw);
+    ctx->period_bytes = period_size * ctx->frame_size;
+
+    /* Start when the ring is full, wake up when a period is free */
+    if ((err = snd_pcm_sw_params_current(ctx->pcm, sw)) < 0)
+        goto Error;
+    if ((err = snd_pcm_sw_params_set_start_threshold(ctx->pcm, sw, buffer_size - period_size)) < 0)
+        goto Error;
+    if ((err = snd_pcm_sw_params_set_avail_min(ctx->pcm, sw, period_size)) < 0)
+        goto Error;
+    if ((err = snd_pcm_sw_params(ctx->pcm, sw)) < 0)
+        goto Error;
+
+    DBG_I("ALSA %s: %s rate %u channels %d buffer %lu period %lu frames\n", ctx->device,
+        snd_pcm_format_name(format), ctx->rate, ctx->channels, buffer_size, period_size);
+
+    return L_OK;
+
+Error:
+    DBG_E("ALSA setup failed: %s\n", snd_strerror(err));
+    return L_FAILED;
+}
+
+/* Restart the device after an underrun or a suspend */
+static int recover(alsa_player_ctx_t *ctx, int err)
+{
+    if (err == -EPIPE)
+    {
+        ctx->underruns++;
+        DBG_W("Audio underrun #%d\n", ctx->underruns);
+    }
+    err = snd_pcm_recover(ctx->pcm, err, 1);
+    if (err < 0)
+        DBG_E("Can not recover ALSA device: %s\n", snd_strerror(err));
+
+    return err;
+}
+
+/* Copy frames to the ring buffer of the device. Waits while it is full */
+static ret_code_t write_mmap(alsa_player_ctx_t *ctx, uint8_t *data, snd_pcm_uframes_t frames)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, size;
+    snd_pcm_sframes_t avail, committed;
+    int err;
+
+    while (frames > 0 && ctx->running && !ctx->flush)
+    {
+        avail = snd_pcm_avail_update(ctx->pcm);
+        if (avail < 0)
+        {
+            if (recover(ctx, avail) < 0)
+                return L_FAILED;
+            continue;
+        }
+        if (!avail)
+        {
+            err = snd_pcm_wait(ctx->pcm, ALSA_WAIT_MS);
+            if (err < 0 && recover(ctx, err) < 0)
+                return L_FAILED;
+            continue;
+        }
+
+        size = frames;
+        if ((err = snd_pcm_mmap_begin(ctx->pcm, &areas, &offset, &size)) < 0)
+        {
+            if (recover(ctx, err) < 0)
+                return L_FAILED;
+            continue;
+        }
+        /* Interleaved access, all channels are in the first area */
+        memcpy((uint8_t *)areas[0].addr + areas[0].first / 8 + offset * areas[0].step / 8, data,
+            size * ctx->frame_size);
+        committed = snd_pcm_mmap_commit(ctx->pcm, offset, size);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != size)
+        {
+            if (recover(ctx, committed >= 0 ? -EPIPE : committed) < 0)
+                return L_FAILED;
+            continue;
+        }
+        data += size * ctx->frame_size;
+        frames -= size;
+    }
+
+    return L_OK;
+}
+
+/* Publish the PTS playing now: the end of written data minus frames queued in the device */
+static void update_playing_pts(alsa_player_ctx_t *ctx, int64_t end_pts_ms)
+{
+    snd_pcm_sframes_t delay;
+    int64_t pts;
+
+    if (snd_pcm_delay(ctx->pcm, &delay) < 0 || delay < 0)
+        delay = 0;
+    pts = end_pts_ms - (int64_t)delay * 1000 / ctx->rate;
+    if (pts < 0)
+        pts = 0;
+
+    decode_set_current_playing_pts(ctx->audio_ctx, pts);
+    avclock_update(ctx->clock, pts);
+}
+
+/* Pause and flush requests are applied by the player thread, the PCM is not shared between threads */
+static void apply_requests(alsa_player_ctx_t *ctx)
+{
+    if (ctx->flush)
+    {
+        snd_pcm_drop(ctx->pcm);
+        snd_pcm_prepare(ctx->pcm);
+        ctx->paused = 0;
+        ctx->flush = 0;
+    }
+    if (ctx->pause == ctx->paused)
+        return;
+
+    if (ctx->pause)
+    {
+        if (!ctx->can_pause || snd_pcm_pause(ctx->pcm, 1) < 0)
+        {
+            /* Queued audio is lost, it is less than the ring length */
+            snd_pcm_drop(ctx->pcm);
+            snd_pcm_prepare(ctx->pcm);
+        }
+    }
+    else if (snd_pcm_state(ctx->pcm) == SND_PCM_STATE_PAUSED)
+    {
+        snd_pcm_pause(ctx->pcm, 0);
+    }
+    ctx->paused = ctx->pause;
+}
+
+static void *player_routine(void *args)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)args;
+    uint8_t *data;
+    int64_t pts;
+    int size;
+    ret_code_t rc;
+    trace_span_t span;
+
+    if (!decode_is_video(ctx->audio_ctx))
+        decode_start_read(ctx->audio_ctx);
+
+    DBG_I("Audio player task started\n");
+
+    while(ctx->running)
+    {
+        apply_requests(ctx);
+        if (ctx->pause)
+        {
+            usleep(100000);
+            continue;
+        }
+
+        audio_player_lock(ctx);
+        size = decode_get_audio_data(ctx->audio_ctx, &data, &pts, &rc);
+        audio_player_unlock(ctx);
+        if (!size)
+        {
+            if (rc != L_STOPPING)
+                DBG_E("Nothing to play\n");
+            usleep(10000);
+            continue;
+        }
+        if (size > ctx->period_bytes)
+            size = ctx->period_bytes;
+
+        trace_begin(&span, "snd_pcm_mmap_write", pts);
+        rc = write_mmap(ctx, data, size / ctx->frame_size);
+        trace_end(&span);
+        if (rc)
+            break;
+        if (pts != AV_NOPTS_VALUE && !ctx->flush)
+            update_playing_pts(ctx, pts + (int64_t)size / ctx->frame_size * 1000 / ctx->rate);
+
+        decode_release_audio_data(ctx->audio_ctx, size);
+    }
+
+    ctx->running = 0;
+    DBG_I("Player task finished\n");
+    return NULL;
+}
+
+void audio_player_lock(audio_player_h h)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)h;
+
+    if (!ctx)
+    {
+        DBG_E("Can not lock audio player\n");
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+}
+
+void audio_player_unlock(audio_player_h h)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)h;
+
+    if (!ctx)
+    {
+        DBG_E("Can not unlock audio player\n");
+        return;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+ret_code_t audio_player_seek(audio_player_h h, seek_direction_t dir, int32_t seek)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)h;
+
+    ctx->flush = 1;
+    /* Restarted by the first buffer after the seek */
+    avclock_reset(ctx->clock);
+
+    return L_OK;
+}
+
+int audio_player_is_runnung(audio_player_h h)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)h;
+
+    return ctx->running;
+}
+
+int audio_player_pause_toggle(audio_player_h player_ctx)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)player_ctx;
+
+    ctx->pause = !ctx->pause;
+    avclock_pause(ctx->clock, ctx->pause);
+
+    return ctx->pause;
+}
+
+ret_code_t audio_player_mute_toggle(audio_player_h player_ctx, int *is_muted)
+{
+    *is_muted = 0;
+
+    return L_OK;
+}
+
+ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock,
+    audio_player_params_t *params)
+{
+    alsa_player_ctx_t *ctx;
+    enum AVSampleFormat fmt;
+    int err;
+
+    ctx = (alsa_player_ctx_t *)malloc(sizeof(alsa_player_ctx_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(alsa_player_ctx_t));
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->audio_ctx = h;
+    ctx->clock = clock;
+    ctx->device = (params && params->device) ? params->device : ALSA_DEF_DEVICE;
+    ctx->latency_ms = params ? params->latency_ms : 0;
+
+    ctx->rate = decode_get_sample_rate(h);
+    ctx->channels = decode_get_channels(h);
+    fmt = decode_get_sample_format(h);
+    ctx->frame_size = av_get_bytes_per_sample(fmt) * ctx->channels;
+    if (!ctx->frame_size || av2alsa(fmt) == SND_PCM_FORMAT_UNKNOWN)
+    {
+        DBG_E("Sample format %s is not supported\n", av_get_sample_fmt_name(fmt));
+        goto Error;
+    }
+
+    if (decode_setup_audio_ring(h, AUDIO_RING_SIZE))
+        goto Error;
+
+    if ((err = snd_pcm_open(&ctx->pcm, ctx->device, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    {
+        DBG_E("Can not open ALSA device %s: %s\n", ctx->device, snd_strerror(err));
+        goto Error;
+    }
+    if (setup_pcm(ctx, av2alsa(fmt)))
+        goto Error;
+
+    ctx->running = 1;
+    /* Use default scheduler. Set SCHED_RR or SCHED_FIFO request root access */
+    if (pthread_create(&ctx->task, NULL, player_routine, ctx))
+    {
+        DBG_E("Create thread falled\n");
+        ctx->running = 0;
+        goto Error;
+    }
+    *player_ctx = ctx;
+
+    return L_OK;
+
+Error:
+    if (ctx->pcm)
+        snd_pcm_close(ctx->pcm);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+    *player_ctx = NULL;
+    return L_FAILED;
+}
+
+void audio_player_stop(audio_player_h player_ctx, int stop)
+{
+    alsa_player_ctx_t *ctx = (alsa_player_ctx_t *)player_ctx;
+
+    if (!ctx)
+        return;
+
+    ctx->running = 0;
+    /* Waiting for player task */
+    pthread_join(ctx->task, NULL);
+
+    /* Play the rest at the end of the stream, drop it if the user stops */
+    if (stop || ctx->paused)
+        snd_pcm_drop(ctx->pcm);
+    else
+        snd_pcm_drain(ctx->pcm);
+    snd_pcm_close(ctx->pcm);
+
+    if (ctx->underruns)
+        DBG_I("Audio underruns: %d\n", ctx->underruns);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
@@ -0,0 +1,460 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Audio player over pulseaudio with the threaded main loop. The server requests data by the write callback,
+ * decoded samples are taken from the ring without waiting and a timer retries when the decoder is behind.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/samplefmt.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "log.h"
+#include "decode.h"
+#include "audio_player.h"
+#include "avclock.h"
+#include "trace.h"
+
+/* Retry interval when the decoder has nothing to write */
+#define RETRY_USEC  (10 * PA_USEC_PER_MSEC)
+
+typedef struct {
+    pa_threaded_mainloop *mainloop;
+    pa_context *context;
+    pa_stream *stream;
+    pa_time_event *retry;
+
+    pa_sample_spec ss;
+    int frame_size;
+
+    int pause;
+    int running;
+    int underruns;
+
+    demux_ctx_h audio_ctx;
+    /* Master clock of the playback */
+    avclock_h clock;
+    int latency_ms;
+} pulse_player_ctx_t;
+
+static void fill_stream(pulse_player_ctx_t *ctx);
+
+static pa_sample_format_t av2pa(enum AVSampleFormat src_fmt)
+{
+    pa_sample_format_t dst_fmt = PA_SAMPLE_INVALID;
+
+    switch(src_fmt)
+    {
+    case AV_SAMPLE_FMT_U8:
+        dst_fmt = PA_SAMPLE_U8;
+        break;
+    case AV_SAMPLE_FMT_S16:
+        dst_fmt = PA_SAMPLE_S16LE;
+        break;
+    case AV_SAMPLE_FMT_S32:
+        dst_fmt = PA_SAMPLE_S32LE;
+        break;
+    case AV_SAMPLE_FMT_FLT:
+        dst_fmt = PA_SAMPLE_FLOAT32LE;
+        break;
+    case AV_SAMPLE_FMT_DBL:
+        dst_fmt = PA_SAMPLE_FLOAT32LE; /* ? */
+        break;
+    default:
+        break;
+    }
+
+    return dst_fmt;
+}
+
+static void context_state_cb(pa_context *c, void *userdata)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)userdata;
+
+    pa_threaded_mainloop_signal(ctx->mainloop, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)userdata;
+
+    pa_threaded_mainloop_signal(ctx->mainloop, 0);
+}
+
+static void stream_success_cb(pa_stream *s, int success, void *userdata)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)userdata;
+
+    pa_threaded_mainloop_signal(ctx->mainloop, 0);
+}
+
+static void stream_write_cb(pa_stream *s, size_t nbytes, void *userdata)
+{
+    fill_stream((pulse_player_ctx_t *)userdata);
+}
+
+static void stream_underflow_cb(pa_stream *s, void *userdata)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)userdata;
+
+    ctx->underruns++;
+    DBG_W("Audio underrun #%d\n", ctx->underruns);
+}
+
+static void retry_cb(pa_mainloop_api *api, pa_time_event *e, const struct timeval *tv, void *userdata)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)userdata;
+
+    api->time_free(e);
+    ctx->retry = NULL;
+    fill_stream(ctx);
+}
+
+/* Publish the PTS playing now: the end of written data minus the audio queued in the server */
+static void update_playing_pts(pulse_player_ctx_t *ctx, int64_t end_pts_ms)
+{
+    pa_usec_t latency;
+    int negative;
+    int64_t pts;
+
+    if (pa_stream_get_latency(ctx->stream, &latency, &negative) < 0 || negative)
+        latency = 0;
+    pts = end_pts_ms - (int64_t)(latency / PA_USEC_PER_MSEC);
+    if (pts < 0)
+        pts = 0;
+
+    decode_set_current_playing_pts(ctx->audio_ctx, pts);
+    avclock_update(ctx->clock, pts);
+}
+
+/* Called from the main loop thread with the lock held */
+static void fill_stream(pulse_player_ctx_t *ctx)
+{
+    uint8_t *data;
+    int64_t pts;
+    size_t writable, size;
+    trace_span_t span;
+    int ret;
+
+    if (!ctx->running || ctx->pause || !ctx->stream)
+        return;
+
+    writable = pa_stream_writable_size(ctx->stream);
+    writable -= writable % ctx->frame_size;
+    while (writable > 0)
+    {
+        size = decode_try_audio_data(ctx->audio_ctx, &data, &pts);
+        if (!size)
+        {
+            /* The decoder is behind. The server does not ask again till the data it has is played */
+            if (!ctx->retry)
+            {
+                ctx->retry = pa_context_rttime_new(ctx->context, pa_rtclock_now() + RETRY_USEC, retry_cb, ctx);
+            }
+            return;
+        }
+
+        /* The whole request is written at once if the ring has it contiguous */
+        if (size > writable)
+            size = writable;
+        trace_begin(&span, "pa_stream_write", pts);
+        ret = pa_stream_write(ctx->stream, data, size, NULL, 0, PA_SEEK_RELATIVE);
+        trace_end(&span);
+        if (ret < 0)
+        {
+            DBG_E("pa_stream_write() failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+            return;
+        }
+        writable -= size;
+
+        if (pts != AV_NOPTS_VALUE)
+            update_playing_pts(ctx, pts + (int64_t)size / ctx->frame_size * 1000 / ctx->ss.rate);
+        decode_release_audio_data(ctx->audio_ctx, size);
+    }
+}
+
+/* Wait for an operation with the lock held */
+static void wait_operation(pulse_player_ctx_t *ctx, pa_operation *op)
+{
+    if (!op)
+        return;
+
+    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(ctx->mainloop);
+    pa_operation_unref(op);
+}
+
+static ret_code_t connect_context(pulse_player_ctx_t *ctx)
+{
+    pa_context_state_t state;
+
+    ctx->context = pa_context_new(pa_threaded_mainloop_get_api(ctx->mainloop), "LBMC");
+    if (!ctx->context)
+    {
+        DBG_E("pa_context_new() failed\n");
+        return L_FAILED;
+    }
+    pa_context_set_state_callback(ctx->context, context_state_cb, ctx);
+    if (pa_context_connect(ctx->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+    {
+        DBG_E("pa_context_connect() failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+        return L_FAILED;
+    }
+
+    while ((state = pa_context_get_state(ctx->context)) != PA_CONTEXT_READY)
+    {
+        if (!PA_CONTEXT_IS_GOOD(state))
+        {
+            DBG_E("Pulse context failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+            return L_FAILED;
+        }
+        pa_threaded_mainloop_wait(ctx->mainloop);
+    }
+
+    return L_OK;
+}
+
+static ret_code_t connect_stream(pulse_player_ctx_t *ctx)
+{
+    pa_buffer_attr attr;
+    pa_stream_state_t state;
+    pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE;
+
+    ctx->stream = pa_stream_new(ctx->context, "playback", &ctx->ss, NULL);
+    if (!ctx->stream)
+    {
+        DBG_E("pa_stream_new() failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+        return L_FAILED;
+    }
+    pa_stream_set_state_callback(ctx->stream, stream_state_cb, ctx);
+    pa_stream_set_write_callback(ctx->stream, stream_write_cb, ctx);
+    pa_stream_set_underflow_callback(ctx->stream, stream_underflow_cb, ctx);
+
+    /* -1 lets the server choose */
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = (uint32_t)-1;
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = (uint32_t)-1;
+    attr.fragsize = (uint32_t)-1;
+    if (ctx->latency_ms)
+    {
+        attr.tlength = pa_usec_to_bytes(ctx->latency_ms * PA_USEC_PER_MSEC, &ctx->ss);
+        attr.minreq = attr.tlength / 4;
+        flags |= PA_STREAM_ADJUST_LATENCY;
+        DBG_I("Requested latency %d ms (%u bytes)\n", ctx->latency_ms, attr.tlength);
+    }
+
+    if (pa_stream_connect_playback(ctx->stream, NULL, &attr, flags, NULL, NULL) < 0)
+    {
+        DBG_E("pa_stream_connect_playback() failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+        return L_FAILED;
+    }
+
+    while ((state = pa_stream_get_state(ctx->stream)) != PA_STREAM_READY)
+    {
+        if (!PA_STREAM_IS_GOOD(state))
+        {
+            DBG_E("Pulse stream failed: %s\n", pa_strerror(pa_context_errno(ctx->context)));
+            return L_FAILED;
+        }
+        pa_threaded_mainloop_wait(ctx->mainloop);
+    }
+
+    return L_OK;
+}
+
+static void uninit_pulse(pulse_player_ctx_t *ctx)
+{
+    if (!ctx->mainloop)
+        return;
+
+    pa_threaded_mainloop_stop(ctx->mainloop);
+    if (ctx->retry)
+        pa_threaded_mainloop_get_api(ctx->mainloop)->time_free(ctx->retry);
+    if (ctx->stream)
+    {
+        pa_stream_disconnect(ctx->stream);
+        pa_stream_unref(ctx->stream);
+    }
+    if (ctx->context)
+    {
+        pa_context_disconnect(ctx->context);
+        pa_context_unref(ctx->context);
+    }
+    pa_threaded_mainloop_free(ctx->mainloop);
+}
+
+void audio_player_lock(audio_player_h h)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)h;
+
+    if (!ctx)
+    {
+        DBG_E("Can not lock audio player\n");
+        return;
+    }
+    pa_threaded_mainloop_lock(ctx->mainloop);
+}
+
+void audio_player_unlock(audio_player_h h)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)h;
+
+    if (!ctx)
+    {
+        DBG_E("Can not unlock audio player\n");
+        return;
+    }
+    pa_threaded_mainloop_unlock(ctx->mainloop);
+}
+
+/* Called by the seek with the player lock held. Samples of the old position are gone */
+ret_code_t audio_player_seek(audio_player_h h, seek_direction_t dir, int32_t seek)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)h;
+    pa_operation *op;
+
+    op = pa_stream_flush(ctx->stream, NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+    /* Restarted by the first buffer after the seek */
+    avclock_reset(ctx->clock);
+
+    return L_OK;
+}
+
+int audio_player_is_runnung(audio_player_h h)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)h;
+
+    return ctx->running;
+}
+
+int audio_player_pause_toggle(audio_player_h player_ctx)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)player_ctx;
+
+    pa_threaded_mainloop_lock(ctx->mainloop);
+    ctx->pause = !ctx->pause;
+    wait_operation(ctx, pa_stream_cork(ctx->stream, ctx->pause, stream_success_cb, ctx));
+    avclock_pause(ctx->clock, ctx->pause);
+    if (!ctx->pause)
+        fill_stream(ctx);
+    pa_threaded_mainloop_unlock(ctx->mainloop);
+
+    return ctx->pause;
+}
+
+ret_code_t audio_player_mute_toggle(audio_player_h player_ctx, int *is_muted)
+{
+    *is_muted = 0;
+
+    return L_OK;
+}
+
+ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock,
+    audio_player_params_t *params)
+{
+    pulse_player_ctx_t *ctx;
+    enum AVSampleFormat fmt;
+
+    ctx = (pulse_player_ctx_t *)malloc(sizeof(pulse_player_ctx_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(pulse_player_ctx_t));
+    ctx->audio_ctx = h;
+    ctx->clock = clock;
+    ctx->latency_ms = params ? params->latency_ms : 0;
+
+    ctx->ss.rate = decode_get_sample_rate(h);
+    ctx->ss.channels = decode_get_channels(h);
+    fmt = decode_get_sample_format(h);
+    ctx->ss.format = av2pa(fmt);
+    ctx->frame_size = av_get_bytes_per_sample(fmt) * ctx->ss.channels;
+
+    if (!ctx->frame_size || decode_setup_audio_ring(h, AUDIO_RING_SIZE))
+        goto Error;
+
+    DBG_I("Open pulse audio. format: %s rate: %d channels: %d\n", pa_sample_format_to_string(ctx->ss.format),
+        ctx->ss.rate, ctx->ss.channels);
+
+    ctx->mainloop = pa_threaded_mainloop_new();
+    if (!ctx->mainloop)
+    {
+        DBG_E("pa_threaded_mainloop_new() failed\n");
+        goto Error;
+    }
+    pa_threaded_mainloop_lock(ctx->mainloop);
+    if (pa_threaded_mainloop_start(ctx->mainloop) < 0)
+    {
+        DBG_E("pa_threaded_mainloop_start() failed\n");
+        pa_threaded_mainloop_unlock(ctx->mainloop);
+        goto Error;
+    }
+    if (connect_context(ctx) || connect_stream(ctx))
+    {
+        pa_threaded_mainloop_unlock(ctx->mainloop);
+        goto Error;
+    }
+    ctx->running = 1;
+    fill_stream(ctx);
+    pa_threaded_mainloop_unlock(ctx->mainloop);
+
+    if (!decode_is_video(h))
+        decode_start_read(h);
+
+    DBG_I("Audio player started\n");
+    *player_ctx = ctx;
+
+    return L_OK;
+
+Error:
+    uninit_pulse(ctx);
+    free(ctx);
+    *player_ctx = NULL;
+    return L_FAILED;
+}
+
+void audio_player_stop(audio_player_h player_ctx, int stop)
+{
+    pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)player_ctx;
+
+    if (!ctx)
+        return;
+
+    pa_threaded_mainloop_lock(ctx->mainloop);
+    ctx->running = 0;
+    /* Play the rest at the end of the stream, drop it if the user stops */
+    if (!stop && !ctx->pause)
+        wait_operation(ctx, pa_stream_drain(ctx->stream, stream_success_cb, ctx));
+    pa_threaded_mainloop_unlock(ctx->mainloop);
+
+    if (ctx->underruns)
+        DBG_I("Audio underruns: %d\n", ctx->underruns);
+    uninit_pulse(ctx);
+
+    free(ctx);
+}
@@ -35,6 +35,11 @@
 #include "audio_player.h"
 #include "timeutils.h"
 #include "msleep.h"
+#include "avclock.h"
+#include "trace.h"
+
+/* Samples written by one call if the latency is chosen by the server */
+#define PULSE_WRITE_MS  20
 
 typedef struct {
     pthread_t task;
@@ -50,6 +55,10 @@ typedef struct {
     struct timespec start_pause;
 
     demux_ctx_h audio_ctx;
+    /* Master clock of the playback */
+    avclock_h clock;
+    /* Requested output latency in ms, 0 - server default */
+    int latency_ms;
 } pulse_player_ctx_t;
 
 static int init_context(pulse_player_ctx_t *ctx)
@@ -97,28 +106,77 @@ static pa_sample_format_t av2pa(enum AVSampleFormat src_fmt)
     return dst_fmt;
 }
 
+/*
+ * Publish the PTS the sink is playing now: the end of written data minus the audio queued in the server.
+ * end_pts_ms - PTS right after the last written sample.
+ */
+static void update_playing_pts(pulse_player_ctx_t *ctx, pa_simple *s, int64_t end_pts_ms)
+{
+    pa_usec_t latency;
+    int error;
+    int64_t pts;
+
+    latency = pa_simple_get_latency(s, &error);
+    if (latency == (pa_usec_t)-1)
+    {
+        DBG_V("pa_simple_get_latency() failed: %s\n", pa_strerror(error));
+        latency = 0;
+    }
+    pts = end_pts_ms - (int64_t)(latency / 1000);
+    if (pts < 0)
+        pts = 0;
+
+    decode_set_current_playing_pts(ctx->audio_ctx, pts);
+    avclock_update(ctx->clock, pts);
+}
+
 static void *player_routine(void *args)
 {
     pulse_player_ctx_t *ctx = (pulse_player_ctx_t *)args;
     pa_sample_spec ss;
+    pa_buffer_attr attr;
     pa_simple *s = NULL;
     int error;
-    media_buffer_t *buf;
+    uint8_t *data;
+    int64_t pts;
+    int size, chunk;
     enum AVSampleFormat fmt;
     ret_code_t rc;
+    int frame_size;
+    int ret;
+    trace_span_t span;
 
     ss.rate = decode_get_sample_rate(ctx->audio_ctx);
     ss.channels = decode_get_channels(ctx->audio_ctx);
     fmt = decode_get_sample_format(ctx->audio_ctx);
     ss.format = av2pa(fmt);
+    frame_size = av_get_bytes_per_sample(fmt) * ss.channels;
 
-    if (decode_setup_audio_buffers(ctx->audio_ctx, AUDIO_BUFFERS, AUDIO_BUFF_ALIGN, AUDIO_BUFF_SIZE))
+    if (!frame_size || decode_setup_audio_ring(ctx->audio_ctx, AUDIO_RING_SIZE))
         return NULL;
 
     DBG_I("Open pulse audio. format: %s rate: %d channels: %d\n", pa_sample_format_to_string(ss.format), ss.rate,
         ss.channels);
 
-    if (!(s = pa_simple_new(NULL, "LBMC", PA_STREAM_PLAYBACK, NULL, "playback", &ss, NULL, NULL, &error)))
+    /* -1 lets the server choose */
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = (uint32_t)-1;
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = (uint32_t)-1;
+    attr.fragsize = (uint32_t)-1;
+    if (ctx->latency_ms)
+    {
+        attr.tlength = pa_usec_to_bytes(ctx->latency_ms * PA_USEC_PER_MSEC, &ss);
+        attr.minreq = attr.tlength / 4;
+        DBG_I("Requested latency %d ms (%u bytes)\n", ctx->latency_ms, attr.tlength);
+    }
+    /* Write by server requests. Whole frames only */
+    chunk = ctx->latency_ms ? attr.minreq : pa_usec_to_bytes(PULSE_WRITE_MS * PA_USEC_PER_MSEC, &ss);
+    chunk -= chunk % frame_size;
+    if (chunk < frame_size)
+        chunk = frame_size;
+
+    if (!(s = pa_simple_new(NULL, "LBMC", PA_STREAM_PLAYBACK, NULL, "playback", &ss, NULL, &attr, &error)))
     {
         DBG_E("pa_simple_new() failed: %s\n", pa_strerror(error));
         goto finish;
@@ -142,57 +200,62 @@ static void *player_routine(void *args)
         }
 
         audio_player_lock(ctx);
-        buf = decode_get_next_audio_buffer(ctx->audio_ctx, &rc);
+        size = decode_get_audio_data(ctx->audio_ctx, &data, &pts, &rc);
         audio_player_unlock(ctx);
-        if (!buf)
+        if (!size)
         {
             if (rc != L_STOPPING)
                 DBG_E("Nothing to play\n");
             usleep(10000);
             continue;
         }
-
-        decode_set_current_playing_pts(ctx->audio_ctx, buf->pts_ms);
+        if (size > chunk)
+            size = chunk;
 
         if (ctx->first_pkt)
         {
             clock_gettime(CLOCK_MONOTONIC, &ctx->base_time);
             ctx->first_pkt = 0;
         }
-        else if (buf->pts_ms != AV_NOPTS_VALUE)
+        else if (pts != AV_NOPTS_VALUE)
         {
             struct timespec curr_time;
             int diff;
 
             clock_gettime(CLOCK_MONOTONIC, &curr_time);
             diff = util_time_diff(&curr_time, &ctx->base_time);
-            DBG_V("Current PTS=%lld time diff=%d\n", buf->pts_ms, diff);
-            if (diff > 0 && buf->pts_ms > diff)
+            DBG_V("Current PTS=%lld time diff=%d\n", pts, diff);
+            if (diff > 0 && pts > diff)
             {
-                diff = buf->pts_ms - diff;
+                diff = pts - diff;
                 if (diff > 5000)
                 {
                     DBG_E("The frame requests %d msec wait. Drop it and continue\n", diff);
-                    decode_release_audio_buffer(ctx->audio_ctx, buf);
+                    decode_release_audio_data(ctx->audio_ctx, size);
                     continue;
                 }
                 DBG_V("Going to sleep for %d ms\n", diff);
                 msleep_wait(ctx->sched, diff);
             }
-            else if (diff > buf->pts_ms + 30)
+            else if (diff > pts + 30)
             {
                 DBG_V("Drop this packet\n");
                 goto Drop;
             }
         }
 
-        if (pa_simple_write(s, buf->s.audio.data[0], buf->size, &error) < 0) 
+        trace_begin(&span, "pa_simple_write", pts);
+        ret = pa_simple_write(s, data, size, &error);
+        trace_end(&span);
+        if (ret < 0)
         {
             DBG_E("pa_simple_write() failed: %s\n", pa_strerror(error));
             break;
         }
+        if (pts != AV_NOPTS_VALUE)
+            update_playing_pts(ctx, s, pts + (int64_t)size / frame_size * 1000 / ss.rate);
 Drop:
-        decode_release_audio_buffer(ctx->audio_ctx, buf);
+        decode_release_audio_data(ctx->audio_ctx, size);
     }
 
 finish:
@@ -238,6 +301,8 @@ ret_code_t audio_player_seek(audio_player_h h, seek_direction_t dir, int32_t see
         util_time_sub(&ctx->base_time, seek);
     else if (dir == L_SEEK_BACKWARD)
         util_time_add(&ctx->base_time, seek);
+    /* Restarted by the first buffer after the seek */
+    avclock_reset(ctx->clock);
 
     return L_OK;
 }
@@ -267,6 +332,7 @@ int audio_player_pause_toggle(audio_player_h player_ctx)
         clock_gettime(CLOCK_MONOTONIC, &ctx->start_pause);
     }
     ctx->pause = !ctx->pause;
+    avclock_pause(ctx->clock, ctx->pause);
 
     return ctx->pause;
 }
@@ -278,7 +344,8 @@ ret_code_t audio_player_mute_toggle(audio_player_h player_ctx, int *is_muted)
     return L_OK;
 }
 
-ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock)
+ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock,
+    audio_player_params_t *params)
 {
     pulse_player_ctx_t *ctx;
     ret_code_t rc = L_OK;
@@ -292,6 +359,8 @@ ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *c
 
     init_context(ctx);
     ctx->audio_ctx = h;
+    ctx->clock = clock;
+    ctx->latency_ms = params ? params->latency_ms : 0;
 
     *player_ctx = ctx;
     /* Use default scheduler. Set SCHED_RR or SCHED_FIFO request root access */
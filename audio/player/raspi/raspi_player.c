@@ -330,7 +330,8 @@ static void *player_routine(void *args)
     return NULL;
 }
 
-ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, ilcore_comp_h clock)
+ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, ilcore_comp_h clock,
+    audio_player_params_t *params)
 {
     player_ctx_t *ctx;
     ret_code_t rc = L_OK;
@@ -39,16 +39,62 @@
 #include "timeutils.h"
 #include "msleep.h"
 #include "queue.h"
+#include "ring_queue.h"
+#include "sample_pack.h"
+#include "pcm_ring.h"
+#include "trace.h"
+#ifdef CONFIG_VIDEO
+#include "video_scale.h"
+#endif
 
 #define SAMPLE_PER_BUFFER 4096
+/* Compressed packets queued between the demuxer and a stream decoder */
+#define AUDIO_PACKETS       256
+#define VIDEO_PACKETS       64
+/* Capacity of free/filled media buffer queues, upper limit of buffers allocated per stream */
+#define MEDIA_QUEUE_SIZE    256
+/* Poll interval for waits that have to watch the stop flag */
+#define DECODE_WAIT_MS      100
+/*
+ * Decoder degradation ladder. Average frame lateness above SKIP_LATE_MS for SKIP_UP_HOLD_MS moves one step up,
+ * frames coming in advance for SKIP_DOWN_HOLD_MS move one step down.
+ */
+#define SKIP_LEVEL_MAX      4
+#define SKIP_LATE_MS        40
+#define SKIP_UP_HOLD_MS     1000
+#define SKIP_DOWN_HOLD_MS   3000
+
+/*
+ * Viewport following. Frames are scaled to SCALE_STEPS fractions of the source size, a new size is applied after
+ * the viewport keeps it for SCALE_HOLD_MS. Resizing a window does not rebuild the conversion on every frame.
+ */
+#define SCALE_STEPS         8
+#define SCALE_HOLD_MS       300
+
+typedef struct {
+    queue_node_t node;
+    AVPacket pkt;
+    /* Seek generation the packet was read in */
+    uint32_t gen;
+} packet_node_t;
 
 typedef struct {
     struct SwrContext *swr;
     struct AVCodecContext *codec;
     AVStream *st;
 
-    queue_h free_buff;
-    queue_h fill_buff;
+    ring_queue_h free_buff;
+    ring_queue_h fill_buff;
+
+    /* Compressed packets from the demuxer */
+    queue_h pkt_free;
+    queue_h pkt_fill;
+    pthread_t task;
+    /*
+     * Stream requested by decode_next_audio_stream() or -1. The switching is done by the decode task between
+     * packets, so the caller never waits for the player to free buffers.
+     */
+    int next_stream_idx;
 
     /* Requested buffers parameters */
     int amount;
@@ -66,13 +112,51 @@ typedef struct {
     enum AVSampleFormat dst_fmt;
     /* Destination sample rate */
     int sample_rate;
+    /* Decoder output is already in the destination format, the resampler is not used */
+    int passthrough;
+    int passthrough_frames;
+    /* Planar stereo is interleaved by an in-tree converter instead of the resampler */
+    sample_pack_func_t pack;
+    /* Samples go to the ring instead of media buffers if the player set it up */
+    pcm_ring_h ring;
+    /* Seek generation the codec state belongs to. Set by the decode task */
+    uint32_t dec_gen;
 } app_audio_ctx_t;
 
 #ifdef CONFIG_VIDEO
 typedef struct {
 #ifndef CONFIG_VIDEO_HW_DECODE
     AVCodecContext *codec;
-    struct SwsContext *sws;
+    video_scale_h scale;
+    /* Conversion bands. 0 - by number of CPUs */
+    int scale_workers;
+    /* Size of converted frames */
+    int out_width;
+    int out_height;
+    /* Viewport size reported by the player. 0 - source size */
+    int req_width;
+    int req_height;
+    /* Output size waiting for SCALE_HOLD_MS and time it was seen first */
+    int pend_width;
+    int pend_height;
+    struct timespec pend_time;
+    /* Degradation ladder level requested by the player lateness and the one set to the codec */
+    int skip_level;
+    int skip_applied;
+    /* Average lateness of frames reported by the player */
+    int late_avg;
+    /* Time of the last level change and since frames come in advance */
+    struct timespec skip_time;
+    struct timespec early_time;
+#else
+    /* Packets are handed to the player by reference */
+    int pkt_passthrough;
+    /* Passthrough is disabled from the command line */
+    int pkt_copy;
+    /* Bytes copied to media buffers, total and at the last statistic print */
+    uint64_t bytes_copied;
+    uint64_t stat_bytes;
+    struct timespec stat_time;
 #endif
     AVStream *st;
     enum AVCodecID codec_id;
@@ -84,9 +168,18 @@ typedef struct {
     uint8_t *codec_ext_data;
     int codec_ext_data_size;
     enum AVPixelFormat pix_fmt;
+    /* Pixel format negotiated with the video player */
+    enum AVPixelFormat out_pix_fmt;
+    /* Decoded frames are handed to the player by reference */
+    int passthrough;
+
+    ring_queue_h free_buff;
+    ring_queue_h fill_buff;
 
-    queue_h free_buff;
-    queue_h fill_buff;
+    /* Compressed packets from the demuxer */
+    queue_h pkt_free;
+    queue_h pkt_fill;
+    pthread_t task;
 
     /* Requested buffers parameters */
     int amount;
@@ -99,6 +192,16 @@ typedef struct {
     int subtitle_stream_idx;
     int stream_idx;
     int frame_count;
+    /* Frames held by the decoder before the first output */
+    int delay_frames;
+    /* Frames shown and dropped by the player */
+    int frames_shown;
+    int frames_dropped;
+    /* Running mean and variance of the present time error, us */
+    int64_t present_mean;
+    int64_t present_var;
+    /* Seek generation the codec state belongs to. Set by the decode task */
+    uint32_t dec_gen;
 } app_video_ctx_t;
 #endif
 
@@ -115,6 +218,10 @@ typedef struct {
 
     pthread_t task;
     int stop_decode;
+    /* Demuxer reached the end of file. Decoders drain their queues and exit */
+    int demux_eof;
+    /* Incremented by each seek, under the decoder lock */
+    uint32_t seek_gen;
     /* Current playing PTS in ms */
     int64_t curr_pts;
     int show_info;
@@ -123,9 +230,16 @@ typedef struct {
 /* Prototypes */
 static enum AVSampleFormat planar_sample_to_same_packed(enum AVSampleFormat fmt);
 static void *read_demux_data(void *ctx);
-static ret_code_t open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx, enum AVMediaType type);
+static void *audio_decode_routine(void *args);
+#ifdef CONFIG_VIDEO
+static void *video_decode_routine(void *args);
+#endif
+static ret_code_t open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx, enum AVMediaType type,
+    decode_params_t *params);
 static ret_code_t resampling_config(app_audio_ctx_t *ctx, int reinit);
 static void uninit_audio_buffers(app_audio_ctx_t *ctx);
+static void set_audio_codec_opts(AVDictionary **opts);
+static void unref_audio_buffer(media_buffer_t *buff);
 
 static int64_t ts2ms(AVRational *time_base, int64_t ts)
 {
@@ -135,6 +249,123 @@ static int64_t ts2ms(AVRational *time_base, int64_t ts)
     return ts * time_base->num * 1000 / time_base->den;
 }
 
+static ret_code_t init_packet_queues(queue_h *pkt_free, queue_h *pkt_fill, int amount)
+{
+    packet_node_t *node;
+    int i;
+
+    if (queue_init(pkt_free) || queue_init(pkt_fill))
+        return L_FAILED;
+
+    for (i = 0; i < amount; i++)
+    {
+        node = (packet_node_t *)malloc(sizeof(packet_node_t));
+        if (!node)
+        {
+            DBG_E("Memory allocation failed\n");
+            return L_FAILED;
+        }
+        memset(node, 0, sizeof(packet_node_t));
+        av_init_packet(&node->pkt);
+
+        queue_push(*pkt_free, (queue_node_t *)node);
+    }
+
+    return L_OK;
+}
+
+/* Drop all queued packets and return the nodes to the free queue */
+static void flush_packet_queue(queue_h pkt_free, queue_h pkt_fill)
+{
+    queue_node_t *first, *node;
+
+    /* Whole queue is detached and returned by one lock each */
+    first = queue_pop_batch(pkt_fill, 0, NULL);
+    for (node = first; node; node = node->next)
+        av_packet_unref(&((packet_node_t *)node)->pkt);
+
+    queue_push_batch(pkt_free, first);
+}
+
+static void uninit_packet_queues(queue_h pkt_free, queue_h pkt_fill)
+{
+    flush_packet_queue(pkt_free, pkt_fill);
+    /* queue_uninit() releases the nodes */
+    queue_uninit(pkt_free);
+    queue_uninit(pkt_fill);
+}
+
+static ret_code_t push_packet(demux_ctx_t *ctx, queue_h pkt_free, queue_h pkt_fill, AVPacket *pkt, uint32_t gen)
+{
+    packet_node_t *node = NULL;
+
+    while (!ctx->stop_decode && !node)
+        node = (packet_node_t *)queue_pop_timed(pkt_free, DECODE_WAIT_MS);
+
+    if (!node)
+        return L_STOPPING;
+
+    /* The demuxer packet may be valid only until next av_read_frame() */
+    if (av_packet_ref(&node->pkt, pkt) < 0)
+    {
+        DBG_E("Unable to reference packet\n");
+        queue_push(pkt_free, (queue_node_t *)node);
+        return L_FAILED;
+    }
+    node->gen = gen;
+    queue_push(pkt_fill, (queue_node_t *)node);
+
+    return L_OK;
+}
+
+/*
+ * Get next queued packet of a stream. Return NULL on stop request or when the demuxer is finished and
+ * the queue is empty.
+ */
+static packet_node_t *pop_packet(demux_ctx_t *ctx, queue_h pkt_fill)
+{
+    packet_node_t *node;
+    trace_span_t span;
+
+    /* Only real waits are traced */
+    node = (packet_node_t *)queue_pop(pkt_fill);
+    if (node)
+        return node;
+
+    trace_begin(&span, "wait_packet", TRACE_NOPTS);
+    while (!ctx->stop_decode && !node)
+    {
+        node = (packet_node_t *)queue_pop_timed(pkt_fill, DECODE_WAIT_MS);
+        if (!node && ctx->demux_eof && !queue_count(pkt_fill))
+            break;
+    }
+    trace_end(&span);
+
+    return node;
+}
+
+static media_buffer_t *wait_free_buffer(demux_ctx_t *ctx, ring_queue_h free_buff)
+{
+    media_buffer_t *buff;
+    trace_span_t span;
+
+    buff = (media_buffer_t *)ring_queue_pop(free_buff);
+    if (buff)
+        return buff;
+
+    trace_begin(&span, "wait_free_buffer", TRACE_NOPTS);
+    while (!ctx->stop_decode && !buff)
+        buff = (media_buffer_t *)ring_queue_pop_timed(free_buff, DECODE_WAIT_MS);
+    trace_end(&span);
+
+    return buff;
+}
+
+static uint32_t get_seek_gen(demux_ctx_t *ctx)
+{
+    return __atomic_load_n(&ctx->seek_gen, __ATOMIC_ACQUIRE);
+}
+
 void decode_lock(demux_ctx_h h)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
@@ -214,6 +445,14 @@ ret_code_t decode_seek(demux_ctx_h h, seek_direction_t dir, int seek_time_ms, in
         DBG_E("av_seek_frame failed\n");
         return L_FAILED;
     }
+    /* Decode tasks flush their codecs on the next packet. Packets and buffers left from before are dropped */
+    __atomic_add_fetch(&ctx->seek_gen, 1, __ATOMIC_RELEASE);
+    if (decode_is_audio(ctx))
+        flush_packet_queue(ctx->audio_ctx->pkt_free, ctx->audio_ctx->pkt_fill);
+#ifdef CONFIG_VIDEO
+    if (decode_is_video(ctx))
+        flush_packet_queue(ctx->video_ctx->pkt_free, ctx->video_ctx->pkt_fill);
+#endif
     release_all_buffers(ctx);
 
     if (next_pts)
@@ -259,6 +498,7 @@ static ret_code_t reopen_audio_stream(demux_ctx_t *ctx, int cur_inx, int new_inx
 {
     AVCodec *dec;
     AVStream *st;
+    AVDictionary *opts = NULL;
 
     if (!ctx || !ctx->fmt_ctx)
     {
@@ -285,11 +525,14 @@ static ret_code_t reopen_audio_stream(demux_ctx_t *ctx, int cur_inx, int new_inx
         DBG_E("Unable to find decoder %d\n", st->codec->codec_id);
         return L_FAILED;
     }
-    if (avcodec_open2(st->codec, dec, NULL) < 0)
+    set_audio_codec_opts(&opts);
+    if (avcodec_open2(st->codec, dec, &opts) < 0)
     {
         DBG_E("Unable to open codec\n");
+        av_dict_free(&opts);
         return L_FAILED;
     }
+    av_dict_free(&opts);
 
     return L_OK;
 }
@@ -350,39 +593,27 @@ void decode_set_current_playing_pts(demux_ctx_h h, int64_t pts)
     ctx->curr_pts = pts;
 }
 
-ret_code_t decode_next_audio_stream(demux_ctx_h h)
+/* Called by the audio decode task */
+static ret_code_t switch_audio_stream(demux_ctx_t *ctx, int index)
 {
-    demux_ctx_t *ctx = (demux_ctx_t *)h;
-    int index;
     AVStream *st;
     AVCodecContext *dec_ctx = NULL;
     AVCodec *dec = NULL;
     AVDictionary *opts = NULL;
     ret_code_t rc = L_OK;
 
-    if (ctx->audio_ctx->audio_streams < 2)
-        return L_FAILED;
-
-    index = ctx->audio_ctx->stream_idx;
-    while (1)
-    {
-        index++;
-        if (index >= ctx->fmt_ctx->nb_streams)
-            index = 0;
-
-        st = ctx->fmt_ctx->streams[index];
-        if (st->codec->codec_type == AVMEDIA_TYPE_AUDIO)
-            break;
-    }
-    ctx->audio_ctx->st = st;
-
     DBG_I("Next audio stream index is %d\n", index);
 
     decode_lock(ctx);
 
+    st = ctx->fmt_ctx->streams[index];
+    ctx->audio_ctx->st = st;
+
     if (ctx->audio_ctx->swr)
         swr_free(&ctx->audio_ctx->swr);
     ctx->audio_ctx->swr = NULL;
+    ctx->audio_ctx->passthrough = 0;
+    ctx->audio_ctx->pack = NULL;
     if (ctx->audio_ctx->codec)
         avcodec_close(ctx->audio_ctx->codec);
 
@@ -396,6 +627,7 @@ ret_code_t decode_next_audio_stream(demux_ctx_h h)
     }
 
     /* Init the decoders, with or without reference counting */
+    set_audio_codec_opts(&opts);
     if (avcodec_open2(dec_ctx, dec, &opts) < 0)
     {
         DBG_E("Failed to open %s codec\n", av_get_media_type_string(AVMEDIA_TYPE_AUDIO));
@@ -410,12 +642,159 @@ ret_code_t decode_next_audio_stream(demux_ctx_h h)
         rc = L_FAILED;
 
 Exit:
+    av_dict_free(&opts);
     decode_unlock(ctx);
 
     return rc;
 }
 
+ret_code_t decode_next_audio_stream(demux_ctx_h h)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    int index;
+
+    if (ctx->audio_ctx->audio_streams < 2)
+        return L_FAILED;
+
+    /* Repeated requests move on from a stream not switched to yet */
+    index = __atomic_load_n(&ctx->audio_ctx->next_stream_idx, __ATOMIC_ACQUIRE);
+    if (index < 0)
+        index = ctx->audio_ctx->stream_idx;
+    while (1)
+    {
+        index++;
+        if (index >= ctx->fmt_ctx->nb_streams)
+            index = 0;
+
+        if (ctx->fmt_ctx->streams[index]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+            break;
+    }
+    __atomic_store_n(&ctx->audio_ctx->next_stream_idx, index, __ATOMIC_RELEASE);
+
+    return L_OK;
+}
+
 #ifdef CONFIG_VIDEO
+#ifndef CONFIG_VIDEO_HW_DECODE
+static ret_code_t setup_video_scale(app_video_ctx_t *vctx, int width, int height)
+{
+    video_scale_fmt_t src, dst;
+
+    src.width = vctx->codec->width;
+    src.height = vctx->codec->height;
+    src.pix_fmt = vctx->codec->pix_fmt;
+    dst.width = width;
+    dst.height = height;
+    dst.pix_fmt = vctx->out_pix_fmt;
+    if (vctx->scale)
+    {
+        /* Keep worker threads of the conversion */
+        if (video_scale_set_size(vctx->scale, &src, &dst))
+            return L_FAILED;
+    }
+    else if (video_scale_init(&vctx->scale, &src, &dst, vctx->scale_workers))
+    {
+        return L_FAILED;
+    }
+
+    vctx->out_width = width;
+    vctx->out_height = height;
+
+    return L_OK;
+}
+
+/* Smallest step of the source size covering the requested one */
+static int scale_step_size(int req, int src)
+{
+    int size;
+
+    size = (int)(((int64_t)req * SCALE_STEPS + src - 1) / src) * src / SCALE_STEPS;
+
+    /* Keep chroma planes aligned */
+    return (size + 1) & ~1;
+}
+
+/* Follow the viewport size. Frames are only scaled down, a player scales them up by itself */
+static ret_code_t update_video_scale(app_video_ctx_t *vctx)
+{
+    struct timespec now;
+    int width = vctx->req_width;
+    int height = vctx->req_height;
+
+    if (!width || !height || width >= vctx->codec->width || height >= vctx->codec->height)
+    {
+        width = vctx->codec->width;
+        height = vctx->codec->height;
+    }
+    else
+    {
+        width = scale_step_size(width, vctx->codec->width);
+        height = scale_step_size(height, vctx->codec->height);
+        if (width >= vctx->codec->width || height >= vctx->codec->height)
+        {
+            width = vctx->codec->width;
+            height = vctx->codec->height;
+        }
+    }
+    if (width == vctx->out_width && height == vctx->out_height)
+        return L_OK;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (width != vctx->pend_width || height != vctx->pend_height)
+    {
+        vctx->pend_width = width;
+        vctx->pend_height = height;
+        vctx->pend_time = now;
+        return L_OK;
+    }
+    if (util_time_diff(&now, &vctx->pend_time) < SCALE_HOLD_MS)
+        return L_OK;
+
+    DBG_I("Video output size %dx%d -> %dx%d\n", vctx->out_width, vctx->out_height, width, height);
+
+    return setup_video_scale(vctx, width, height);
+}
+
+/* Buffers are reallocated when they come back to the decoder after the output size change */
+static ret_code_t resize_video_buffer(app_video_ctx_t *vctx, media_buffer_t *buff)
+{
+    int rc;
+
+    if (buff->s.video.width == vctx->out_width && buff->s.video.height == vctx->out_height)
+        return L_OK;
+
+    av_freep(&buff->s.video.buffer[0]);
+    rc = av_image_alloc(buff->s.video.buffer, buff->s.video.linesize, vctx->out_width, vctx->out_height,
+        vctx->out_pix_fmt, vctx->buff_align);
+    if (rc < 0)
+    {
+        DBG_E("Could not allocate destination video buffer\n");
+        buff->s.video.width = buff->s.video.height = 0;
+        return L_FAILED;
+    }
+    buff->size = rc;
+    buff->s.video.width = vctx->out_width;
+    buff->s.video.height = vctx->out_height;
+
+    return L_OK;
+}
+#endif
+
+ret_code_t decode_set_video_output_size(demux_ctx_h h, int width, int height)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx || !ctx->video_ctx)
+        return L_FAILED;
+
+#ifndef CONFIG_VIDEO_HW_DECODE
+    ctx->video_ctx->req_width = width;
+    ctx->video_ctx->req_height = height;
+#endif
+
+    return L_OK;
+}
+
 ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int len)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
@@ -425,14 +804,29 @@ ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int
 
     if (ctx->video_ctx->amount != -1)
         amount = ctx->video_ctx->amount;
+    if (amount > MEDIA_QUEUE_SIZE)
+        amount = MEDIA_QUEUE_SIZE;
 
     vctx = ctx->video_ctx;
 #ifdef CONFIG_VIDEO_HW_DECODE
+    DBG_I("Video packets are %s\n", vctx->pkt_passthrough ? "passed by reference" : "copied to buffers");
     for (i = 0; i < amount; i++)
     {
         vbuff = (media_buffer_t *)malloc(sizeof(media_buffer_t));
         memset(vbuff, 0, sizeof(media_buffer_t));
         vbuff->type = MB_VIDEO_TYPE;
+        if (vctx->pkt_passthrough)
+        {
+            /* Payload is referenced from the demuxer packet at the decoding time */
+            vbuff->s.video.pkt = av_packet_alloc();
+            if (!vbuff->s.video.pkt)
+            {
+                DBG_E("Memory allocation failed\n");
+                return L_FAILED;
+            }
+            ring_queue_push(vctx->free_buff, vbuff);
+            continue;
+        }
         if (posix_memalign((void **)&vbuff->s.video.data, align, len))
         {
             DBG_E("Memory allocation failed\n");
@@ -441,10 +835,10 @@ ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int
         vbuff->s.video.buff_size = len;
         DBG_V("Video buffer %p\n", vbuff->s.video.data);
 
-        queue_push(vctx->free_buff, (queue_node_t *)vbuff);
+        ring_queue_push(vctx->free_buff, vbuff);
     }
 #else
-    /* Allocate destination image with same resolution and RGBA pixel format */
+    vctx->passthrough = (vctx->out_pix_fmt == vctx->codec->pix_fmt);
     for (i = 0; i < amount; i++)
     {
         int rc;
@@ -453,25 +847,37 @@ ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int
         memset(vbuff, 0, sizeof(media_buffer_t));
         vbuff->type = MB_VIDEO_TYPE;
 
-        rc = av_image_alloc(vbuff->s.video.buffer, vbuff->s.video.linesize, vctx->codec->width, vctx->codec->height,
-                AV_PIX_FMT_RGBA, align);
-        if (rc < 0)
+        if (vctx->passthrough)
         {
-            DBG_E("Could not allocate destination video buffer\n");
-            return L_FAILED;
+            /* Planes are taken from the decoder frame at the decoding time */
+            vbuff->s.video.frame = av_frame_alloc();
+            if (!vbuff->s.video.frame)
+            {
+                DBG_E("Could not allocate video frame\n");
+                return L_FAILED;
+            }
+            len = av_image_get_buffer_size(vctx->out_pix_fmt, vctx->codec->width, vctx->codec->height, align);
         }
-        vbuff->size = len = rc;
+        else
+        {
+            /* Allocate destination image with same resolution and requested pixel format */
+            rc = av_image_alloc(vbuff->s.video.buffer, vbuff->s.video.linesize, vctx->codec->width,
+                vctx->codec->height, vctx->out_pix_fmt, align);
+            vbuff->s.video.width = vctx->codec->width;
+            vbuff->s.video.height = vctx->codec->height;
+            if (rc < 0)
+            {
+                DBG_E("Could not allocate destination video buffer\n");
+                return L_FAILED;
+            }
+            len = rc;
+        }
+        vbuff->size = len;
 
-        queue_push(vctx->free_buff, (queue_node_t *)vbuff);
+        ring_queue_push(vctx->free_buff, vbuff);
     }
-    /* Create scale context */
-    vctx->sws = sws_getContext(vctx->codec->width, vctx->codec->height, vctx->codec->pix_fmt, vctx->codec->width,
-            vctx->codec->height, AV_PIX_FMT_RGBA, SWS_BILINEAR, NULL, NULL, NULL);
-    if (!vctx->sws)
-    {
-        DBG_E("Can not allocate scale format\n");
+    if (!vctx->passthrough && setup_video_scale(vctx, vctx->codec->width, vctx->codec->height))
         return L_FAILED;
-    }
 #endif
     vctx->buff_allocated = amount;
     vctx->buff_align = align;
@@ -482,9 +888,64 @@ ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int
 
     return L_OK;
 }
+
+ret_code_t decode_negotiate_video_format(demux_ctx_h h, const enum AVPixelFormat *formats,
+    enum AVPixelFormat *pix_fmt)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    app_video_ctx_t *vctx;
+    enum AVPixelFormat out_fmt = AV_PIX_FMT_NONE;
+    int i;
+
+    if (!ctx->video_ctx || !formats)
+    {
+        DBG_E("Video context not allocated or no formats\n");
+        return L_FAILED;
+    }
+    vctx = ctx->video_ctx;
+
+    /* The decoder output is displayed as is */
+    for (i = 0; formats[i] != AV_PIX_FMT_NONE; i++)
+    {
+        if (formats[i] == vctx->pix_fmt)
+        {
+            out_fmt = formats[i];
+            break;
+        }
+    }
+    /* Convert to the best ranked format */
+    if (out_fmt == AV_PIX_FMT_NONE)
+    {
+        for (i = 0; formats[i] != AV_PIX_FMT_NONE; i++)
+        {
+            if (sws_isSupportedOutput(formats[i]))
+            {
+                out_fmt = formats[i];
+                break;
+            }
+        }
+    }
+    if (out_fmt == AV_PIX_FMT_NONE)
+    {
+        DBG_E("No suitable output format for %s\n", av_get_pix_fmt_name(vctx->pix_fmt));
+        return L_FAILED;
+    }
+    vctx->out_pix_fmt = out_fmt;
+
+    if (out_fmt == vctx->pix_fmt)
+        DBG_I("Video output path: %s passthrough\n", av_get_pix_fmt_name(out_fmt));
+    else
+        DBG_I("Video output path: %s -> %s conversion\n", av_get_pix_fmt_name(vctx->pix_fmt),
+            av_get_pix_fmt_name(out_fmt));
+
+    if (pix_fmt)
+        *pix_fmt = out_fmt;
+
+    return L_OK;
+}
 #endif
 
-ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
+ret_code_t decode_init(demux_ctx_h *h, char *src_file, decode_params_t *params)
 {
     demux_ctx_t *ctx;
     int streams = 0;
@@ -500,7 +961,7 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
         return L_FAILED;
     }
     memset(ctx, 0, sizeof(demux_ctx_t));
-    ctx->show_info = show_info;
+    ctx->show_info = params->show_info;
     msleep_init(&ctx->pause);
     pthread_mutex_init(&ctx->lock, NULL);
     /* open input file, and allocate format context */
@@ -517,7 +978,7 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
     }
 #ifdef CONFIG_VIDEO
     DBG_I("Format name: %s\n", ctx->fmt_ctx->iformat->name);
-    if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_VIDEO))
+    if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_VIDEO, params))
     {
         app_video_ctx_t *vctx;
         AVStream *video_stream = NULL;
@@ -534,18 +995,30 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
 
         memset(vctx, 0, sizeof(app_video_ctx_t));
         vctx->stream_idx = stream_index;
-        queue_init(&vctx->free_buff);
-        queue_init(&vctx->fill_buff);
+        /*
+         * Free buffers come back from players, OMX callbacks and a seek. Decoded ones are pushed only by the decode
+         * task and popped under the video player lock
+         */
+        ring_queue_init(&vctx->free_buff, MEDIA_QUEUE_SIZE, RING_QUEUE_SHARED_PUSH | RING_QUEUE_SHARED_POP);
+        ring_queue_init(&vctx->fill_buff, MEDIA_QUEUE_SIZE, 0);
+        if (init_packet_queues(&vctx->pkt_free, &vctx->pkt_fill, VIDEO_PACKETS))
+            return L_FAILED;
         vctx->subtitle_stream_idx = -1;
 
         video_stream = ctx->fmt_ctx->streams[stream_index];
 #ifndef CONFIG_VIDEO_HW_DECODE
         vctx->codec = video_stream->codec;
+        vctx->scale_workers = params->scale_workers;
+        clock_gettime(CLOCK_MONOTONIC, &vctx->skip_time);
+        vctx->early_time = vctx->skip_time;
+#else
+        vctx->pkt_copy = params->packet_copy;
 #endif
         vctx->st = video_stream;
         vctx->width = video_stream->codec->width;
         vctx->height = video_stream->codec->height;
         vctx->pix_fmt = video_stream->codec->pix_fmt;
+        vctx->out_pix_fmt = AV_PIX_FMT_RGBA;
         vctx->codec_id = video_stream->codec->codec_id;
        
         vctx->codec_ext_data = (uint8_t *)malloc(video_stream->codec->extradata_size);
@@ -562,10 +1035,15 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
             vctx->fps_rate = video_stream->r_frame_rate.num;
             vctx->fps_scale = video_stream->r_frame_rate.den;
         }
+        /* Frame threading delays output by one frame per additional thread */
+        vctx->delay_frames = video_stream->codec->has_b_frames;
+        if (video_stream->codec->active_thread_type & FF_THREAD_FRAME)
+            vctx->delay_frames += video_stream->codec->thread_count - 1;
+        DBG_I("Video decoder delay: %d frames (%d ms)\n", vctx->delay_frames, decode_get_video_latency(ctx));
        
         DBG_I("Video stream was found. index=%d\n", stream_index); 
 
-        if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_SUBTITLE))
+        if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_SUBTITLE, NULL))
         {
             DBG_I("Subtitles stream was found\n");
 
@@ -573,7 +1051,7 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
         }
     }
 #endif
-    if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_AUDIO))
+    if (!open_codec_context(&stream_index, ctx->fmt_ctx, AVMEDIA_TYPE_AUDIO, NULL))
     {
         app_audio_ctx_t *actx;
         AVStream *audio_stream = NULL;
@@ -598,8 +1076,12 @@ ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info)
         stream_index = first_index;
         actx->stream_idx = stream_index;
 
-        queue_init(&actx->free_buff);
-        queue_init(&actx->fill_buff);
+        /* An audio player may pop decoded buffers while a seek flushes them */
+        ring_queue_init(&actx->free_buff, MEDIA_QUEUE_SIZE, RING_QUEUE_SHARED_PUSH | RING_QUEUE_SHARED_POP);
+        ring_queue_init(&actx->fill_buff, MEDIA_QUEUE_SIZE, RING_QUEUE_SHARED_POP);
+        if (init_packet_queues(&actx->pkt_free, &actx->pkt_fill, AUDIO_PACKETS))
+            return L_FAILED;
+        actx->next_stream_idx = -1;
 
         audio_stream = ctx->fmt_ctx->streams[stream_index];
         actx->codec = audio_stream->codec;
@@ -640,14 +1122,16 @@ void decode_uninit(demux_ctx_h h)
 
         /* Release allocated buffers */
         uninit_audio_buffers(actx);
+        pcm_ring_uninit(actx->ring);
         /* Release resampling context */
         if (actx->swr)
             swr_free(&actx->swr);
         if (actx->codec)
             avcodec_close(actx->codec);
 
-        queue_uninit(actx->free_buff);
-        queue_uninit(actx->fill_buff);
+        ring_queue_uninit(actx->free_buff);
+        ring_queue_uninit(actx->fill_buff);
+        uninit_packet_queues(actx->pkt_free, actx->pkt_fill);
 
         free(actx);
     }
@@ -658,35 +1142,50 @@ void decode_uninit(demux_ctx_h h)
         app_video_ctx_t *vctx = ctx->video_ctx;
 
 #ifdef CONFIG_VIDEO_HW_DECODE
-        while ((buff = (media_buffer_t *)queue_pop(vctx->free_buff)) != NULL)
+        if (vctx->bytes_copied)
+            DBG_I("Compressed video copied to buffers: %llu bytes\n", (unsigned long long)vctx->bytes_copied);
+        while ((buff = (media_buffer_t *)ring_queue_pop(vctx->free_buff)) != NULL)
         {
-            free(buff->s.video.data);
+            if (buff->s.video.pkt)
+                av_packet_free(&buff->s.video.pkt);
+            else
+                free(buff->s.video.data);
             free(buff);
         }
-        while ((buff = (media_buffer_t *)queue_pop(vctx->fill_buff)) != NULL)
+        while ((buff = (media_buffer_t *)ring_queue_pop(vctx->fill_buff)) != NULL)
         {
-            free(buff->s.video.data);
+            if (buff->s.video.pkt)
+                av_packet_free(&buff->s.video.pkt);
+            else
+                free(buff->s.video.data);
             free(buff);
         }
 #else
         if (vctx->codec)
             avcodec_close(vctx->codec);
-        if (vctx->sws)
-            sws_freeContext(vctx->sws);
+        if (vctx->scale)
+            video_scale_uninit(vctx->scale);
 
-        while ((buff = (media_buffer_t *)queue_pop(vctx->free_buff)) != NULL)
+        while ((buff = (media_buffer_t *)ring_queue_pop(vctx->free_buff)) != NULL)
         {
-            av_freep(&buff->s.video.buffer[0]);
+            if (buff->s.video.frame)
+                av_frame_free(&buff->s.video.frame);
+            else
+                av_freep(&buff->s.video.buffer[0]);
             free(buff);
         }
-        while ((buff = (media_buffer_t *)queue_pop(vctx->fill_buff)) != NULL)
+        while ((buff = (media_buffer_t *)ring_queue_pop(vctx->fill_buff)) != NULL)
         {
-            av_freep(&buff->s.video.buffer[0]);
+            if (buff->s.video.frame)
+                av_frame_free(&buff->s.video.frame);
+            else
+                av_freep(&buff->s.video.buffer[0]);
             free(buff);
         }
 #endif
-        queue_uninit(vctx->free_buff);
-        queue_uninit(vctx->fill_buff);
+        ring_queue_uninit(vctx->free_buff);
+        ring_queue_uninit(vctx->fill_buff);
+        uninit_packet_queues(vctx->pkt_free, vctx->pkt_fill);
 
         if (vctx->codec_ext_data)
             free(vctx->codec_ext_data);
@@ -725,7 +1224,8 @@ void decode_release_audio_buffer(demux_ctx_h h, media_buffer_t *buff)
         return;
     }
 
-    queue_push(ctx->audio_ctx->free_buff, (queue_node_t *)buff);
+    unref_audio_buffer(buff);
+    ring_queue_push(ctx->audio_ctx->free_buff, buff);
 }
 
 #ifdef CONFIG_VIDEO
@@ -738,8 +1238,20 @@ void decode_release_video_buffer(demux_ctx_h h, media_buffer_t *buff)
         DBG_E("Video context not allocated\n");
         return;
     }
+#ifdef CONFIG_VIDEO_HW_DECODE
+    /* Drop the reference to the demuxer packet */
+    if (buff->s.video.pkt)
+    {
+        av_packet_unref(buff->s.video.pkt);
+        buff->s.video.data = NULL;
+    }
+#else
+    /* Give the frame back to the decoder pool */
+    if (buff->s.video.frame)
+        av_frame_unref(buff->s.video.frame);
+#endif
 
-    queue_push(ctx->video_ctx->free_buff, (queue_node_t *)buff);
+    ring_queue_push(ctx->video_ctx->free_buff, buff);
 }
 #endif
 
@@ -794,15 +1306,31 @@ media_buffer_t *decode_get_free_audio_buffer(demux_ctx_h h)
         return NULL;
     }
 
-    abuff = (media_buffer_t *)queue_pop(ctx->audio_ctx->free_buff);
+    abuff = (media_buffer_t *)ring_queue_pop(ctx->audio_ctx->free_buff);
 
     return abuff;
 }
 
+/* Buffers decoded before the last seek go back to the free queue. timeout in ms, 0 - do not wait */
+static media_buffer_t *pop_audio_buffer(demux_ctx_t *ctx, int timeout)
+{
+    media_buffer_t *buff;
+
+    while ((buff = (media_buffer_t *)ring_queue_pop_timed(ctx->audio_ctx->fill_buff, timeout)) != NULL)
+    {
+        if (buff->gen == get_seek_gen(ctx))
+            break;
+        decode_release_audio_buffer(ctx, buff);
+    }
+
+    return buff;
+}
+
 media_buffer_t *decode_get_next_audio_buffer(demux_ctx_h h, ret_code_t *rc)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
     media_buffer_t *abuf;
+    trace_span_t span;
 
     if (!ctx->audio_ctx)
     {
@@ -818,7 +1346,13 @@ media_buffer_t *decode_get_next_audio_buffer(demux_ctx_h h, ret_code_t *rc)
             *rc = L_STOPPING;
         return NULL;
     }
-    abuf = (media_buffer_t *)queue_pop_timed(ctx->audio_ctx->fill_buff, 500);
+    abuf = pop_audio_buffer(ctx, 0);
+    if (!abuf)
+    {
+        trace_begin(&span, "wait_audio_buffer", TRACE_NOPTS);
+        abuf = pop_audio_buffer(ctx, 500);
+        trace_end(&span);
+    }
     if (!abuf)
     {
         if (rc)
@@ -832,31 +1366,127 @@ media_buffer_t *decode_get_next_audio_buffer(demux_ctx_h h, ret_code_t *rc)
     return abuf;    
 }
 
-#ifdef CONFIG_VIDEO
-media_buffer_t *decode_get_free_video_buffer(demux_ctx_h h)
+media_buffer_t *decode_try_next_audio_buffer(demux_ctx_h h)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
-    media_buffer_t *vbuff;
 
-    if (!ctx || !ctx->video_ctx)
-    {
-        DBG_E("Video context not allocated\n");
+    if (!ctx->audio_ctx || ctx->stop_decode)
         return NULL;
-    }
 
-    vbuff = (media_buffer_t *)queue_pop(ctx->video_ctx->free_buff);
-
-    return vbuff;
+    return pop_audio_buffer(ctx, 0);
 }
 
-media_buffer_t *decode_get_next_video_buffer(demux_ctx_h h, ret_code_t *rc)
+ret_code_t decode_setup_audio_ring(demux_ctx_h h, int size)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
-    media_buffer_t *vbuff = NULL;
+    app_audio_ctx_t *actx = ctx->audio_ctx;
 
-    if (!ctx->video_ctx)
+    if (!actx)
     {
-        if (rc)
+        DBG_E("Audio context not allocated\n");
+        return L_FAILED;
+    }
+    /* Same amount of memory as requested buffers */
+    if (actx->amount > 0 && actx->size > 0)
+        size = actx->amount * actx->size;
+
+    if (pcm_ring_init(&actx->ring, size, av_get_bytes_per_sample(actx->dst_fmt) * 2, actx->sample_rate))
+        return L_FAILED;
+
+    DBG_I("Allocated audio ring, size=%d\n", size);
+
+    return L_OK;
+}
+
+int decode_get_audio_data(demux_ctx_h h, uint8_t **data, int64_t *pts_ms, ret_code_t *rc)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    int size;
+
+    if (!ctx->audio_ctx || !ctx->audio_ctx->ring)
+    {
+        if (rc)
+            *rc = L_FAILED;
+        DBG_E("Audio ring not allocated\n");
+        return 0;
+    }
+
+    if (ctx->stop_decode)
+    {
+        if (rc)
+            *rc = L_STOPPING;
+        return 0;
+    }
+    size = pcm_ring_peek(ctx->audio_ctx->ring, data, pts_ms, 500);
+    if (rc)
+        *rc = size ? L_OK : L_TIMEOUT;
+
+    return size;
+}
+
+int decode_try_audio_data(demux_ctx_h h, uint8_t **data, int64_t *pts_ms)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx->audio_ctx || !ctx->audio_ctx->ring || ctx->stop_decode)
+        return 0;
+
+    return pcm_ring_peek(ctx->audio_ctx->ring, data, pts_ms, 0);
+}
+
+void decode_release_audio_data(demux_ctx_h h, int size)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx->audio_ctx || !ctx->audio_ctx->ring)
+    {
+        DBG_E("Audio ring not allocated\n");
+        return;
+    }
+    pcm_ring_consume(ctx->audio_ctx->ring, size);
+}
+
+#ifdef CONFIG_VIDEO
+media_buffer_t *decode_get_free_video_buffer(demux_ctx_h h)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    media_buffer_t *vbuff;
+
+    if (!ctx || !ctx->video_ctx)
+    {
+        DBG_E("Video context not allocated\n");
+        return NULL;
+    }
+
+    vbuff = (media_buffer_t *)ring_queue_pop(ctx->video_ctx->free_buff);
+
+    return vbuff;
+}
+
+/* Buffers decoded before the last seek go back to the free queue. timeout in ms, 0 - do not wait */
+static media_buffer_t *pop_video_buffer(demux_ctx_t *ctx, int timeout)
+{
+    media_buffer_t *buff;
+
+    while ((buff = (media_buffer_t *)ring_queue_pop_timed(ctx->video_ctx->fill_buff, timeout)) != NULL)
+    {
+        if (buff->gen == get_seek_gen(ctx))
+            break;
+        decode_release_video_buffer(ctx, buff);
+    }
+
+    return buff;
+}
+
+media_buffer_t *decode_get_next_video_buffer(demux_ctx_h h, ret_code_t *rc)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    media_buffer_t *vbuff = NULL;
+    trace_span_t span;
+
+    if (!ctx->video_ctx)
+    {
+        if (rc)
             *rc = L_FAILED;
         DBG_E("Video context not allocated\n");
         return NULL;
@@ -868,7 +1498,13 @@ media_buffer_t *decode_get_next_video_buffer(demux_ctx_h h, ret_code_t *rc)
         return NULL;
     }
 
-    vbuff = (media_buffer_t *)queue_pop_timed(ctx->video_ctx->fill_buff, 500);
+    vbuff = pop_video_buffer(ctx, 0);
+    if (!vbuff)
+    {
+        trace_begin(&span, "wait_video_buffer", TRACE_NOPTS);
+        vbuff = pop_video_buffer(ctx, 500);
+        trace_end(&span);
+    }
     if (!vbuff)
     {
         if (rc)
@@ -882,6 +1518,66 @@ media_buffer_t *decode_get_next_video_buffer(demux_ctx_h h, ret_code_t *rc)
     return vbuff;
 }
 
+media_buffer_t *decode_try_next_video_buffer(demux_ctx_h h)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx->video_ctx || ctx->stop_decode)
+        return NULL;
+
+    return pop_video_buffer(ctx, 0);
+}
+
+void decode_count_video_frame(demux_ctx_h h, int dropped)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx->video_ctx)
+        return;
+
+    if (dropped)
+        ctx->video_ctx->frames_dropped++;
+    else
+        ctx->video_ctx->frames_shown++;
+}
+
+void decode_report_video_present(demux_ctx_h h, int error_us)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    app_video_ctx_t *vctx;
+    int64_t dev;
+
+    if (!ctx->video_ctx)
+        return;
+
+    vctx = ctx->video_ctx;
+    dev = error_us - vctx->present_mean;
+    vctx->present_mean += dev / 32;
+    vctx->present_var += (dev * dev - vctx->present_var) / 32;
+}
+
+static int isqrt(int64_t v)
+{
+    int64_t r = 0, bit = (int64_t)1 << 62;
+
+    while (bit > v)
+        bit >>= 2;
+    while (bit)
+    {
+        if (v >= r + bit)
+        {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+        {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (int)r;
+}
+
 int decode_is_video(demux_ctx_h h)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
@@ -941,6 +1637,16 @@ void decode_stop(demux_ctx_h h)
     ctx->stop_decode = 1;
 }
 
+/* Give the frame back to the decoder pool and switch the buffer to own samples */
+static void unref_audio_buffer(media_buffer_t *buff)
+{
+    if (buff->s.audio.data == buff->s.audio.own_data)
+        return;
+
+    av_frame_unref(buff->s.audio.frame);
+    buff->s.audio.data = buff->s.audio.own_data;
+}
+
 static ret_code_t realloc_audio_buffer(media_buffer_t *buffer, enum AVSampleFormat dst_fmt)
 {
     int dst_linesize;
@@ -971,6 +1677,8 @@ ret_code_t decode_setup_audio_buffers(demux_ctx_h h, int amount, int align, int
 
     if (ctx->audio_ctx->amount != -1)
         amount = ctx->audio_ctx->amount;
+    if (amount > MEDIA_QUEUE_SIZE)
+        amount = MEDIA_QUEUE_SIZE;
 
     dst_fmt = ctx->audio_ctx->codec->sample_fmt;
     if (av_sample_fmt_is_planar(dst_fmt)) 
@@ -1001,9 +1709,19 @@ ret_code_t decode_setup_audio_buffers(demux_ctx_h h, int amount, int align, int
             break;
         }
         ctx->audio_ctx->buff_size = buff->s.audio.buff_size = len = dst_linesize;
+        buff->s.audio.own_data = buff->s.audio.data;
         DBG_V("Buffer address is %p size=%d\n", buff->s.audio.data[0], dst_linesize);
+#ifdef CONFIG_PC
+        buff->s.audio.frame = av_frame_alloc();
+        if (!buff->s.audio.frame)
+        {
+            rc = L_FAILED;
+            DBG_E("Could not allocate audio frame\n");
+            break;
+        }
+#endif
 
-        queue_push(ctx->audio_ctx->free_buff, (queue_node_t *)buff);
+        ring_queue_push(ctx->audio_ctx->free_buff, buff);
     }
 
     ctx->audio_ctx->buff_allocated = amount;
@@ -1022,13 +1740,17 @@ void release_all_buffers(demux_ctx_h h)
     media_buffer_t *buff;
 
     if (decode_is_audio(ctx))
-        while ((buff = (media_buffer_t *)queue_pop(ctx->audio_ctx->fill_buff)) != NULL)
-            queue_push(ctx->audio_ctx->free_buff, (queue_node_t *)buff);
+    {
+        while ((buff = (media_buffer_t *)ring_queue_pop(ctx->audio_ctx->fill_buff)) != NULL)
+            decode_release_audio_buffer(ctx, buff);
+        if (ctx->audio_ctx->ring)
+            pcm_ring_flush(ctx->audio_ctx->ring);
+    }
 
 #ifdef CONFIG_VIDEO
     if (decode_is_video(ctx))
-        while ((buff = (media_buffer_t *)queue_pop(ctx->video_ctx->fill_buff)) != NULL)
-            queue_push(ctx->video_ctx->free_buff, (queue_node_t *)buff);
+        while ((buff = (media_buffer_t *)ring_queue_pop(ctx->video_ctx->fill_buff)) != NULL)
+            decode_release_video_buffer(ctx, buff);
 #endif
 }
 
@@ -1036,18 +1758,20 @@ static void uninit_audio_buffers(app_audio_ctx_t *ctx)
 {
     media_buffer_t *buff;
 
-    while ((buff = (media_buffer_t *)queue_pop(ctx->free_buff)) != NULL)
+    while ((buff = (media_buffer_t *)ring_queue_pop(ctx->free_buff)) != NULL)
     {
-        if (buff->s.audio.data)
-            av_freep(&buff->s.audio.data[0]);
+        if (buff->s.audio.own_data)
+            av_freep(&buff->s.audio.own_data[0]);
+        av_frame_free(&buff->s.audio.frame);
 
         free(buff);
     }
 
-    while ((buff = (media_buffer_t *)queue_pop(ctx->fill_buff)) != NULL)
+    while ((buff = (media_buffer_t *)ring_queue_pop(ctx->fill_buff)) != NULL)
     {
-        if (buff->s.audio.data)
-            av_freep(&buff->s.audio.data[0]);
+        if (buff->s.audio.own_data)
+            av_freep(&buff->s.audio.own_data[0]);
+        av_frame_free(&buff->s.audio.frame);
 
         free(buff);
     }
@@ -1085,20 +1809,100 @@ static enum AVSampleFormat planar_sample_to_same_packed(enum AVSampleFormat fmt)
     return dst_fmt;
 }
 
-static int decode_audio_packet(int *got_frame, int cached, app_audio_ctx_t *ctx, AVFrame *frame, AVPacket *pkt)
+/* Wait for free space in the ring. Return its size in whole frames, 0 if decoding stops */
+static int wait_ring_space(demux_ctx_t *ctx, uint8_t **data, int frame_size)
+{
+    int size;
+    trace_span_t span;
+
+    size = pcm_ring_reserve(ctx->audio_ctx->ring, data, 0);
+    if (size)
+        return size / frame_size;
+
+    trace_begin(&span, "wait_ring_space", TRACE_NOPTS);
+    while (!ctx->stop_decode && !size)
+        size = pcm_ring_reserve(ctx->audio_ctx->ring, data, DECODE_WAIT_MS);
+    trace_end(&span);
+
+    return size / frame_size;
+}
+
+/* Append samples of the frame to the ring. Wrapped space is filled by several passes */
+static int write_audio_ring(demux_ctx_t *dctx, AVFrame *frame, int64_t pts_ms)
+{
+    app_audio_ctx_t *ctx = dctx->audio_ctx;
+    int frame_size = av_get_bytes_per_sample(ctx->dst_fmt) * 2;
+    int src_bps = av_get_bytes_per_sample(frame->format);
+    uint8_t *src[2], *dst;
+    int count, done, ret = 0;
+    trace_span_t span;
+
+    if (ctx->passthrough || ctx->pack)
+    {
+        for (done = 0; done < frame->nb_samples; done += count)
+        {
+            count = wait_ring_space(dctx, &dst, frame_size);
+            if (!count)
+                break;
+            count = FFMIN(count, frame->nb_samples - done);
+            if (ctx->passthrough)
+            {
+                memcpy(dst, frame->extended_data[0] + done * frame_size, count * frame_size);
+            }
+            else
+            {
+                src[0] = frame->extended_data[0] + done * src_bps;
+                src[1] = frame->extended_data[1] + done * src_bps;
+                ctx->pack(src, dst, count);
+            }
+            pcm_ring_commit(ctx->ring, count * frame_size, done ? PCM_RING_NOPTS : pts_ms);
+        }
+        if (ctx->passthrough)
+            ctx->passthrough_frames++;
+        return 0;
+    }
+
+    /* Samples not fitting to the space stay in the resampler and are taken by the next call without input */
+    done = 0;
+    do
+    {
+        count = wait_ring_space(dctx, &dst, frame_size);
+        if (!count)
+            break;
+        trace_begin(&span, "swr_convert", done ? TRACE_NOPTS : pts_ms);
+        ret = swr_convert(ctx->swr, &dst, count, (const uint8_t **)frame->extended_data, done ? 0 : frame->nb_samples);
+        trace_end(&span);
+        if (ret < 0)
+        {
+            DBG_E("Error while converting\n");
+            return -1;
+        }
+        pcm_ring_commit(ctx->ring, ret * frame_size, done ? PCM_RING_NOPTS : pts_ms);
+        done = 1;
+    }
+    while (ret == count);
+
+    return 0;
+}
+
+static int decode_audio_packet(demux_ctx_t *dctx, int *got_frame, int cached, AVFrame *frame, AVPacket *pkt)
 {
+    app_audio_ctx_t *ctx = dctx->audio_ctx;
     int ret;
     int decoded;
     enum AVSampleFormat dst_fmt;
     int dst_linesize;
     size_t unpadded_linesize;
     media_buffer_t *buff;
+    trace_span_t span;
 
-    if (!ctx->swr)
+    if (!ctx->swr && !ctx->passthrough && !ctx->pack)
         return -1;
 
     /* decode audio frame */
+    trace_begin(&span, "avcodec_decode_audio4", ts2ms(&ctx->st->time_base, pkt->pts));
     ret = avcodec_decode_audio4(ctx->codec, frame, got_frame, pkt);
+    trace_end(&span);
     if (ret < 0)
     {
         DBG_E("Error decoding audio frame (%s)\n", av_err2str(ret));
@@ -1117,14 +1921,69 @@ static int decode_audio_packet(int *got_frame, int cached, app_audio_ctx_t *ctx,
         frame->nb_samples, ts2ms(&ctx->st->time_base, av_frame_get_best_effort_timestamp(frame)),
         av_frame_get_channels(frame));
 
-    buff = (media_buffer_t *)queue_pop_timed(ctx->free_buff, QUEUE_INFINITE_WAIT);
-    unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample(frame->format);
+    /* A seek came while the packet was decoded. The PCM ring has no generation, so check before writing */
+    if (ctx->dec_gen != get_seek_gen(dctx))
+    {
+        av_frame_unref(frame);
+        return decoded;
+    }
+
+    if (ctx->ring)
+    {
+        ret = write_audio_ring(dctx, frame, (pkt->pts != AV_NOPTS_VALUE) ? ts2ms(&ctx->st->time_base, pkt->pts) :
+            PCM_RING_NOPTS);
+        av_frame_unref(frame);
+
+        return (ret < 0) ? ret : decoded;
+    }
+
+    buff = wait_free_buffer(dctx, ctx->free_buff);
+    if (!buff)
+    {
+        av_frame_unref(frame);
+        return decoded;
+    }
 
     if(pkt->pts != AV_NOPTS_VALUE)
         buff->pts_ms = ts2ms(&ctx->st->time_base, pkt->pts);
     else
         buff->pts_ms = AV_NOPTS_VALUE;
 
+    if (ctx->passthrough)
+    {
+        buff->s.audio.nb_samples = frame->nb_samples;
+        buff->size = av_samples_get_buffer_size(NULL, 2, frame->nb_samples, ctx->dst_fmt, 1);
+#ifdef CONFIG_PC
+        av_frame_move_ref(buff->s.audio.frame, frame);
+        buff->s.audio.data = buff->s.audio.frame->extended_data;
+#else
+        /* OMX render binds memory of buffers, samples are copied */
+        if (buff->s.audio.nb_samples > buff->s.audio.max_nb_samples && realloc_audio_buffer(buff, ctx->dst_fmt))
+            return -1;
+        memcpy(buff->s.audio.data[0], frame->extended_data[0], buff->size);
+        av_frame_unref(frame);
+#endif
+        ctx->passthrough_frames++;
+        buff->gen = ctx->dec_gen;
+        ring_queue_push(ctx->fill_buff, buff);
+
+        return decoded;
+    }
+
+    if (ctx->pack)
+    {
+        buff->s.audio.nb_samples = frame->nb_samples;
+        if (buff->s.audio.nb_samples > buff->s.audio.max_nb_samples && realloc_audio_buffer(buff, ctx->dst_fmt))
+            return -1;
+        ctx->pack(frame->extended_data, buff->s.audio.data[0], frame->nb_samples);
+        buff->size = av_samples_get_buffer_size(NULL, 2, frame->nb_samples, ctx->dst_fmt, 1);
+        av_frame_unref(frame);
+        buff->gen = ctx->dec_gen;
+        ring_queue_push(ctx->fill_buff, buff);
+
+        return decoded;
+    }
+
     dst_fmt = planar_sample_to_same_packed(ctx->codec->sample_fmt);
     /* compute destination number of samples */
     buff->s.audio.nb_samples = av_rescale_rnd(swr_get_delay(ctx->swr, ctx->codec->sample_rate) + frame->nb_samples,
@@ -1134,8 +1993,11 @@ static int decode_audio_packet(int *got_frame, int cached, app_audio_ctx_t *ctx,
         if (realloc_audio_buffer(buff, dst_fmt))
             return -1;
     }
+    trace_begin(&span, "swr_convert", buff->pts_ms);
     ret = swr_convert(ctx->swr, buff->s.audio.data, buff->s.audio.nb_samples, (const uint8_t **)frame->extended_data,
         frame->nb_samples);
+    trace_end(&span);
+    av_frame_unref(frame);
     if (ret < 0) 
     {
         DBG_E("Error while converting\n");
@@ -1149,7 +2011,8 @@ static int decode_audio_packet(int *got_frame, int cached, app_audio_ctx_t *ctx,
     }
     buff->size = (size_t)unpadded_linesize;
 
-    queue_push(ctx->fill_buff, (queue_node_t *)buff);
+    buff->gen = ctx->dec_gen;
+    ring_queue_push(ctx->fill_buff, buff);
 
     return decoded;
 }
@@ -1169,6 +2032,106 @@ ret_code_t decode_get_video_buffs_info(demux_ctx_h h, int *size, int *count, int
     return L_OK;
 }
 
+int decode_get_video_latency(demux_ctx_h h)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    app_video_ctx_t *vctx;
+
+    if (!ctx || !ctx->video_ctx)
+        return 0;
+
+    vctx = ctx->video_ctx;
+    if (!vctx->fps_rate || !vctx->fps_scale)
+        return 0;
+
+    return vctx->delay_frames * 1000 * vctx->fps_scale / vctx->fps_rate;
+}
+
+#ifndef CONFIG_VIDEO_HW_DECODE
+void decode_report_video_lateness(demux_ctx_h h, int late_ms)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+    app_video_ctx_t *vctx;
+    struct timespec now;
+
+    if (!ctx || !ctx->video_ctx)
+        return;
+
+    vctx = ctx->video_ctx;
+    vctx->late_avg = (vctx->late_avg * 7 + late_ms) / 8;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (vctx->late_avg >= 0)
+        vctx->early_time = now;
+
+    if (vctx->late_avg > SKIP_LATE_MS && vctx->skip_level < SKIP_LEVEL_MAX &&
+        util_time_diff(&now, &vctx->skip_time) > SKIP_UP_HOLD_MS)
+    {
+        vctx->skip_level++;
+        vctx->skip_time = now;
+        DBG_I("Video is %d ms late. Decoder skip level %d\n", vctx->late_avg, vctx->skip_level);
+    }
+    else if (vctx->late_avg < 0 && vctx->skip_level > 0 &&
+        util_time_diff(&now, &vctx->skip_time) > SKIP_DOWN_HOLD_MS &&
+        util_time_diff(&now, &vctx->early_time) > SKIP_DOWN_HOLD_MS)
+    {
+        vctx->skip_level--;
+        vctx->skip_time = now;
+        vctx->early_time = now;
+        DBG_I("Video is in time. Decoder skip level %d\n", vctx->skip_level);
+    }
+}
+
+int decode_get_skip_level(demux_ctx_h h)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx || !ctx->video_ctx)
+        return 0;
+
+    return ctx->video_ctx->skip_level;
+}
+
+/* Called from the decoding thread. Every level keeps the savings of the previous ones */
+static void apply_skip_level(app_video_ctx_t *ctx)
+{
+    int level = ctx->skip_level;
+
+    if (level == ctx->skip_applied)
+        return;
+
+    ctx->codec->skip_loop_filter = (level >= 1) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+    ctx->codec->skip_idct = (level >= 2) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    if (level >= 4)
+        ctx->codec->skip_frame = AVDISCARD_NONKEY;
+    else if (level == 3)
+        ctx->codec->skip_frame = AVDISCARD_NONREF;
+    else
+        ctx->codec->skip_frame = AVDISCARD_DEFAULT;
+
+    ctx->skip_applied = level;
+}
+#endif
+
+#ifdef CONFIG_VIDEO_HW_DECODE
+ret_code_t decode_set_packet_passthrough(demux_ctx_h h, int enable)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx || !ctx->video_ctx)
+        return L_FAILED;
+
+    if (enable && ctx->video_ctx->pkt_copy)
+    {
+        DBG_I("Packet passthrough is disabled, packets will be copied\n");
+        enable = 0;
+    }
+    ctx->video_ctx->pkt_passthrough = enable;
+
+    return L_OK;
+}
+#endif
+
 ret_code_t decode_get_pixel_format(demux_ctx_h h, enum AVPixelFormat *pix_fmt)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
@@ -1181,6 +2144,19 @@ ret_code_t decode_get_pixel_format(demux_ctx_h h, enum AVPixelFormat *pix_fmt)
     return L_OK;
 }
 
+ret_code_t decode_get_color_info(demux_ctx_h h, enum AVColorSpace *space, enum AVColorRange *range)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)h;
+
+    if (!ctx || !ctx->video_ctx)
+        return L_FAILED;
+
+    *space = ctx->video_ctx->st->codec->colorspace;
+    *range = ctx->video_ctx->st->codec->color_range;
+
+    return L_OK;
+}
+
 ret_code_t decode_get_codec_id(demux_ctx_h h, enum AVCodecID *codec_id)
 {
     demux_ctx_t *ctx = (demux_ctx_t *)h;
@@ -1221,8 +2197,9 @@ uint8_t *decode_get_codec_extra_data(demux_ctx_h h, int *size)
 }
 
 #ifdef CONFIG_VIDEO_HW_DECODE
-static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx, AVFrame *frame, AVPacket *pkt)
+static int decode_video_packet(demux_ctx_t *dctx, int *got_frame, int cached, AVFrame *frame, AVPacket *pkt)
 {
+    app_video_ctx_t *ctx = dctx->video_ctx;
     media_buffer_t *buff;
 
     if (!pkt->data || !pkt->size)
@@ -1232,12 +2209,26 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
     }
 
     *got_frame = 1;
-    buff = (media_buffer_t *)queue_pop_timed(ctx->free_buff, INFINITE_WAIT);
-    if (pkt->size <= buff->s.video.buff_size)
+    buff = wait_free_buffer(dctx, ctx->free_buff);
+    if (!buff)
+        return 0;
+    if (ctx->pkt_passthrough)
+    {
+        /* The player reads the payload of the demuxer packet, whatever size it is */
+        if (av_packet_ref(buff->s.video.pkt, pkt) < 0)
+        {
+            DBG_E("Unable to reference the packet\n");
+            ring_queue_push(ctx->free_buff, buff);
+            return 0;
+        }
+        buff->s.video.data = buff->s.video.pkt->data;
+        buff->size = buff->s.video.pkt->size;
+    }
+    else if (pkt->size <= buff->s.video.buff_size)
     {
-        /* TODO. Redesign with out memcpy */
         memcpy(buff->s.video.data, pkt->data, pkt->size);
         buff->size = pkt->size;
+        ctx->bytes_copied += pkt->size;
     }
     else
     {
@@ -1250,6 +2241,7 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
             DBG_V("Part of buffer: %d bytes size=%d\n", to_copy, size);
             memcpy(buff->s.video.data, &pkt->data[saved], to_copy);
             buff->size = to_copy;
+            ctx->bytes_copied += to_copy;
             saved += to_copy;
             size -= to_copy;
             if (size)
@@ -1267,9 +2259,12 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
                 if (buff->dts_ms == -1)
                     buff->dts_ms = AV_NOPTS_VALUE;
 
-                queue_push(ctx->fill_buff, (queue_node_t *)buff);
+                buff->gen = ctx->dec_gen;
+                ring_queue_push(ctx->fill_buff, buff);
 
-                buff = (media_buffer_t *)queue_pop_timed(ctx->free_buff, INFINITE_WAIT);
+                buff = wait_free_buffer(dctx, ctx->free_buff);
+                if (!buff)
+                    return 0;
             }
         } while (size);
     }
@@ -1287,17 +2282,23 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
     if (buff->dts_ms == -1)
         buff->dts_ms = AV_NOPTS_VALUE;
 
-    queue_push(ctx->fill_buff, (queue_node_t *)buff);
+    buff->gen = ctx->dec_gen;
+    ring_queue_push(ctx->fill_buff, buff);
 
     return 0;
 }
 #else
-static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx, AVFrame *frame, AVPacket *pkt)
+static int decode_video_packet(demux_ctx_t *dctx, int *got_frame, int cached, AVFrame *frame, AVPacket *pkt)
 {
+    app_video_ctx_t *ctx = dctx->video_ctx;
     int rc;
     media_buffer_t *buff;
+    trace_span_t span;
 
+    apply_skip_level(ctx);
+    trace_begin(&span, "avcodec_decode_video2", ts2ms(&ctx->st->time_base, pkt->pts));
     rc = avcodec_decode_video2(ctx->codec, frame, got_frame, pkt);
+    trace_end(&span);
     if (rc < 0)
     {
         DBG_E("Error decoding video frame (%s)\n", av_err2str(rc));
@@ -1314,6 +2315,7 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
             "pixel format of the input video changed:\nold: width = %d, height = %d, format = %s\nnew: width = %d, "
             "height = %d, format = %s\n", ctx->codec->width,ctx->codec-> height,
             av_get_pix_fmt_name(ctx->codec->pix_fmt), frame->width, frame->height, av_get_pix_fmt_name(frame->format));
+        av_frame_unref(frame);
         return -1;
     }
 
@@ -1322,22 +2324,52 @@ static int decode_video_packet(int *got_frame, int cached, app_video_ctx_t *ctx,
         av_ts2timestr(av_frame_get_best_effort_timestamp(frame), &ctx->st->time_base),
         ts2ms(&ctx->codec->time_base, av_frame_get_best_effort_timestamp(frame)));
 
-    buff = (media_buffer_t *)queue_pop_timed(ctx->free_buff, QUEUE_INFINITE_WAIT);
+    if (!ctx->passthrough && update_video_scale(ctx))
+    {
+        av_frame_unref(frame);
+        return -1;
+    }
+
+    buff = wait_free_buffer(dctx, ctx->free_buff);
+    if (!buff)
+    {
+        av_frame_unref(frame);
+        return 0;
+    }
 
-    rc = sws_scale(ctx->sws, (const uint8_t * const*)frame->data, frame->linesize, 0, ctx->codec->height,
-        buff->s.video.buffer, buff->s.video.linesize);
-    if (rc < 0)
+    if (ctx->passthrough)
     {
-        DBG_E("sws_scale failed\n");
-        return rc;
+        int i;
+
+        /* Take a reference instead of copying. Released by decode_release_video_buffer */
+        av_frame_move_ref(buff->s.video.frame, frame);
+        for (i = 0; i < 4; i++)
+        {
+            buff->s.video.buffer[i] = buff->s.video.frame->data[i];
+            buff->s.video.linesize[i] = buff->s.video.frame->linesize[i];
+        }
+        buff->s.video.width = buff->s.video.frame->width;
+        buff->s.video.height = buff->s.video.frame->height;
+        frame = buff->s.video.frame;
     }
-    
-    if(pkt->dts != AV_NOPTS_VALUE)
-        buff->pts_ms = ts2ms(&ctx->st->time_base, av_frame_get_best_effort_timestamp(frame));
     else
-        buff->pts_ms = AV_NOPTS_VALUE;
+    {
+        if (resize_video_buffer(ctx, buff) || video_scale_frame(ctx->scale, frame->data, frame->linesize,
+            buff->s.video.buffer, buff->s.video.linesize))
+        {
+            av_frame_unref(frame);
+            ring_queue_push(ctx->free_buff, buff);
+            return -1;
+        }
+    }
+    
+    /* Frames drained at the end of stream come with an empty packet */
+    buff->pts_ms = ts2ms(&ctx->st->time_base, av_frame_get_best_effort_timestamp(frame));
+    if (!ctx->passthrough)
+        av_frame_unref(frame);
 
-    queue_push(ctx->fill_buff, (queue_node_t *)buff);
+    buff->gen = ctx->dec_gen;
+    ring_queue_push(ctx->fill_buff, buff);
 
     return 0;
 }
@@ -1350,37 +2382,142 @@ static int decode_subtitle_packet(app_video_ctx_t *ctx, AVPacket *pkt)
 }
 #endif
 
-static int decode_packet(int *got_frame, int cached, demux_ctx_t *ctx, AVFrame *frame, AVPacket *pkt)
+static void *audio_decode_routine(void *args)
 {
-    int decoded = pkt->size;
+    demux_ctx_t *ctx = (demux_ctx_t *)args;
+    app_audio_ctx_t *actx = ctx->audio_ctx;
+    packet_node_t *node;
+    AVPacket pkt;
+    AVFrame *frame;
+    int got_frame, ret, index;
+    uint32_t gen;
 
-    *got_frame = 0;
+    frame = av_frame_alloc();
+    if (!frame)
+    {
+        DBG_E("Could not allocate audio frame\n");
+        return NULL;
+    }
+    DBG_I("Start audio decode task\n");
 
-#ifdef CONFIG_VIDEO
-    if (ctx->video_ctx && pkt->stream_index == ctx->video_ctx->stream_idx)
+    while ((node = pop_packet(ctx, actx->pkt_fill)) != NULL)
     {
-        if (decode_video_packet(got_frame, cached, ctx->video_ctx, frame, pkt) < 0)
-            return -1;
+        index = __atomic_exchange_n(&actx->next_stream_idx, -1, __ATOMIC_ACQ_REL);
+        if (index >= 0)
+            switch_audio_stream(ctx, index);
+
+        gen = get_seek_gen(ctx);
+        if (actx->dec_gen != gen)
+        {
+            /* Frames held by the codec are from the position before the seek */
+            avcodec_flush_buffers(actx->codec);
+            actx->dec_gen = gen;
+        }
+
+        /*
+         * Packets of a previous stream may be still queued after an audio stream switching, packets read before
+         * a seek may be queued after the flush
+         */
+        if (node->pkt.stream_index == actx->stream_idx && node->gen == gen)
+        {
+            pkt = node->pkt;
+            do
+            {
+                ret = decode_audio_packet(ctx, &got_frame, 0, frame, &pkt);
+                if (ret < 0)
+                    break;
+                pkt.data += ret;
+                pkt.size -= ret;
+            }
+            while (pkt.size > 0 && !ctx->stop_decode);
+        }
+
+        av_packet_unref(&node->pkt);
+        queue_push(actx->pkt_free, (queue_node_t *)node);
     }
-    else if (ctx->video_ctx && pkt->stream_index == ctx->video_ctx->subtitle_stream_idx)
+
+    if (!ctx->stop_decode)
     {
-        *got_frame = 1;
-        if (decode_subtitle_packet(ctx->video_ctx, pkt) < 0)
-            return -1;
+        /* Get frames delayed by the decoder */
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+        do
+        {
+            if (decode_audio_packet(ctx, &got_frame, 1, frame, &pkt) < 0)
+                break;
+        }
+        while (got_frame && !ctx->stop_decode);
     }
-    else
+
+    av_frame_free(&frame);
+    DBG_I("Stop audio decode task\n");
+
+    return NULL;
+}
+
+#ifdef CONFIG_VIDEO
+static void *video_decode_routine(void *args)
+{
+    demux_ctx_t *ctx = (demux_ctx_t *)args;
+    app_video_ctx_t *vctx = ctx->video_ctx;
+    packet_node_t *node;
+    AVFrame *frame;
+    int got_frame;
+    uint32_t gen;
+
+    frame = av_frame_alloc();
+    if (!frame)
+    {
+        DBG_E("Could not allocate video frame\n");
+        return NULL;
+    }
+    DBG_I("Start video decode task\n");
+
+    while ((node = pop_packet(ctx, vctx->pkt_fill)) != NULL)
+    {
+        gen = get_seek_gen(ctx);
+        if (vctx->dec_gen != gen)
+        {
+#ifndef CONFIG_VIDEO_HW_DECODE
+            /* Frames held by the codec are from the position before the seek */
+            avcodec_flush_buffers(vctx->codec);
 #endif
-    if (ctx->audio_ctx && pkt->stream_index == ctx->audio_ctx->stream_idx)
+            vctx->dec_gen = gen;
+        }
+        /* Packets read before a seek may be queued after the flush */
+        if (node->gen == gen)
+            decode_video_packet(ctx, &got_frame, 0, frame, &node->pkt);
+
+        av_packet_unref(&node->pkt);
+        queue_push(vctx->pkt_free, (queue_node_t *)node);
+    }
+
+    if (!ctx->stop_decode)
     {
-        decoded = decode_audio_packet(got_frame, cached, ctx->audio_ctx, frame, pkt);
-        if (decoded < 0)
-            return -1;
+        AVPacket pkt;
+
+        /* Get frames delayed by the decoder */
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+        do
+        {
+            if (decode_video_packet(ctx, &got_frame, 1, frame, &pkt) < 0)
+                break;
+        }
+        while (got_frame && !ctx->stop_decode);
     }
 
-    return decoded;
+    av_frame_free(&frame);
+    DBG_I("Stop video decode task\n");
+
+    return NULL;
 }
+#endif
 
-static ret_code_t open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx, enum AVMediaType type)
+static ret_code_t open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx, enum AVMediaType type,
+    decode_params_t *params)
 {
     int stream_index;
     AVStream *st;
@@ -1408,22 +2545,73 @@ static ret_code_t open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx,
         return L_FAILED;
     }
 
+    if (type == AVMEDIA_TYPE_VIDEO && params)
+    {
+        dec_ctx->thread_count = params->threads;
+        dec_ctx->thread_type = params->thread_type;
+    }
+
     /* Init the decoders, with or without reference counting */
+#ifndef CONFIG_VIDEO_HW_DECODE
+    /* Video frames are owned by the caller. It allows to keep them until rendered */
+    if (type == AVMEDIA_TYPE_VIDEO)
+        av_dict_set(&opts, "refcounted_frames", "1", 0);
+#endif
+    if (type == AVMEDIA_TYPE_AUDIO)
+        set_audio_codec_opts(&opts);
     if (avcodec_open2(dec_ctx, dec, &opts) < 0)
     {
         DBG_E("Failed to open %s codec\n", av_get_media_type_string(type));
+        av_dict_free(&opts);
         return L_FAILED;
     }
+    av_dict_free(&opts);
+    if (type == AVMEDIA_TYPE_VIDEO)
+    {
+        DBG_I("Video decoder threads: %d type: %s\n", dec_ctx->thread_count,
+            (dec_ctx->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+            (dec_ctx->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none");
+    }
     *stream_idx = stream_index;
 
     return L_OK;
 }
 
+static void set_audio_codec_opts(AVDictionary **opts)
+{
+#ifdef CONFIG_PC
+    /* Frames are owned by the caller. Players take them by reference when no conversion is needed */
+    av_dict_set(opts, "refcounted_frames", "1", 0);
+#endif
+}
+
 static ret_code_t resampling_config(app_audio_ctx_t *ctx, int reinit)
 {
     ret_code_t ret = L_OK;
-    enum AVSampleFormat dst_fmt;
     char chan_layout_str[32];
+    int stereo;
+
+    if (!reinit)
+    {
+        ctx->dst_fmt = planar_sample_to_same_packed(ctx->codec->sample_fmt);
+        ctx->sample_rate = ctx->codec->sample_rate;
+    }
+    /* Stereo at the output rate. Packed one goes to players as is, planar one needs an interleave only */
+    stereo = ctx->codec->sample_rate == ctx->sample_rate && ctx->codec->channels == 2 &&
+        (!ctx->codec->channel_layout || ctx->codec->channel_layout == AV_CH_LAYOUT_STEREO);
+    ctx->passthrough = stereo && ctx->codec->sample_fmt == ctx->dst_fmt;
+    if (ctx->passthrough)
+    {
+        DBG_I("Audio format: %s rate:%d. No conversion\n", av_get_sample_fmt_name(ctx->dst_fmt), ctx->sample_rate);
+        return L_OK;
+    }
+    ctx->pack = stereo ? sample_pack_get_func(ctx->codec->sample_fmt, ctx->dst_fmt) : NULL;
+    if (ctx->pack)
+    {
+        DBG_I("Audio format: %s -> %s rate:%d. Interleave only\n", av_get_sample_fmt_name(ctx->codec->sample_fmt),
+            av_get_sample_fmt_name(ctx->dst_fmt), ctx->sample_rate);
+        return L_OK;
+    }
 
     /* create resampler context */
     ctx->swr = swr_alloc();
@@ -1444,20 +2632,8 @@ static ret_code_t resampling_config(app_audio_ctx_t *ctx, int reinit)
     /* Destination layout */
     /* Still only stereo output */
     av_opt_set_int(ctx->swr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
-    if (!reinit)
-    {
-        av_opt_set_int(ctx->swr, "out_sample_rate", ctx->codec->sample_rate, 0);
-        dst_fmt = planar_sample_to_same_packed(ctx->codec->sample_fmt);
-        av_opt_set_sample_fmt(ctx->swr, "out_sample_fmt", dst_fmt, 0);
-
-        ctx->dst_fmt = dst_fmt;
-        ctx->sample_rate = ctx->codec->sample_rate;
-    }
-    else
-    {
-        av_opt_set_int(ctx->swr, "out_sample_rate", ctx->sample_rate, 0);
-        av_opt_set_sample_fmt(ctx->swr, "out_sample_fmt", ctx->dst_fmt, 0);
-    }
+    av_opt_set_int(ctx->swr, "out_sample_rate", ctx->sample_rate, 0);
+    av_opt_set_sample_fmt(ctx->swr, "out_sample_fmt", ctx->dst_fmt, 0);
     /* initialize the resampling context */
     if (swr_init(ctx->swr) < 0)
     {
@@ -1474,6 +2650,7 @@ void print_stream_info(demux_ctx_h h)
     int count, i, duration = 0;
     int hour, min, sec, curr_hour, curr_min, curr_sec;
     int temp;
+    int audio_fill = 0, audio_total = 0;
 
     if (!ctx || !ctx->show_info)
         return;
@@ -1506,18 +2683,69 @@ void print_stream_info(demux_ctx_h h)
     temp /= 60;
     hour = temp;
 
+    /* Filled and total audio buffers or KB of the ring */
+    if (ctx->audio_ctx && ctx->audio_ctx->ring)
+    {
+        pcm_ring_get_fill(ctx->audio_ctx->ring, &audio_fill, &audio_total);
+        audio_fill /= 1024;
+        audio_total /= 1024;
+    }
+    else if (ctx->audio_ctx)
+    {
+        audio_fill = ring_queue_count(ctx->audio_ctx->fill_buff);
+        audio_total = ctx->audio_ctx->buff_allocated;
+    }
+    /* Audio frames played without conversion */
+    if (ctx->audio_ctx && ctx->audio_ctx->passthrough_frames)
+        fprintf(stderr, "AP-%d ", ctx->audio_ctx->passthrough_frames);
 #ifdef CONFIG_VIDEO
+#ifndef CONFIG_VIDEO_HW_DECODE
+    /* Frame conversion time, last and average */
+    if (ctx->video_ctx && ctx->video_ctx->scale)
+    {
+        int last_us, avg_us;
+
+        video_scale_get_time(ctx->video_ctx->scale, &last_us, &avg_us);
+        fprintf(stderr, "CV-%05d/%05dus ", last_us, avg_us);
+    }
+    if (ctx->video_ctx)
+        fprintf(stderr, "SK-%d ", ctx->video_ctx->skip_level);
+#else
+    /* Rate of compressed data copied to media buffers since the last print */
+    if (ctx->video_ctx && !ctx->video_ctx->pkt_passthrough)
+    {
+        app_video_ctx_t *vctx = ctx->video_ctx;
+        struct timespec now;
+        int ms;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ms = util_time_diff(&now, &vctx->stat_time);
+        if (vctx->stat_time.tv_sec && ms > 0)
+        {
+            fprintf(stderr, "CP-%05dKB/s ", (int)((vctx->bytes_copied - vctx->stat_bytes) * 1000 / 1024 / ms));
+        }
+        vctx->stat_time = now;
+        vctx->stat_bytes = vctx->bytes_copied;
+    }
+#endif
+    if (ctx->video_ctx && (ctx->video_ctx->frames_shown || ctx->video_ctx->frames_dropped))
+    {
+        fprintf(stderr, "FR-%d/%d JD-%05dus ", ctx->video_ctx->frames_shown, ctx->video_ctx->frames_dropped,
+            isqrt(ctx->video_ctx->present_var));
+        /* Video follows the audio clock, the mean error of the present time is the A/V offset */
+        if (ctx->audio_ctx)
+            fprintf(stderr, "AV-%+05dms ", (int)(ctx->video_ctx->present_mean / 1000));
+    }
     if (ctx->video_ctx && ctx->audio_ctx)
     {
         fprintf(stderr, "V-%02d:%02d  A-%02d:%02d TS-%02d:%02d:%02d/%02d:%02d:%02d          \r",
-            queue_count(ctx->video_ctx->fill_buff), ctx->video_ctx->buff_allocated,
-            queue_count(ctx->audio_ctx->fill_buff), ctx->audio_ctx->buff_allocated, curr_hour, curr_min, curr_sec, hour,
-            min, sec);
+            ring_queue_count(ctx->video_ctx->fill_buff), ctx->video_ctx->buff_allocated, audio_fill, audio_total,
+            curr_hour, curr_min, curr_sec, hour, min, sec);
     }
     else if (ctx->video_ctx)
     {
         fprintf(stderr, "V-%02d:%02d TS-%02d:%02d:%02d/%02d:%02d:%02d          \r",
-            queue_count(ctx->video_ctx->fill_buff), ctx->video_ctx->buff_allocated, curr_hour, curr_min, curr_sec, hour,
+            ring_queue_count(ctx->video_ctx->fill_buff), ctx->video_ctx->buff_allocated, curr_hour, curr_min, curr_sec, hour,
             min, sec);
     }
     else
@@ -1525,29 +2753,42 @@ void print_stream_info(demux_ctx_h h)
     if (ctx->audio_ctx)
     {
         fprintf(stderr, "A-%02d:%02d TS-%02d:%02d:%02d/%02d:%02d:%02d          \r",
-            queue_count(ctx->audio_ctx->fill_buff), ctx->audio_ctx->buff_allocated, curr_hour, curr_min, curr_sec, hour,
-            min, sec);
+            audio_fill, audio_total, curr_hour, curr_min, curr_sec, hour, min, sec);
     }
 }
 
 static void *read_demux_data(void *args)
 {
     AVPacket pkt;
-    int ret;
-    int got_frame;
-    AVFrame *frame = NULL;
+    trace_span_t span;
     demux_ctx_t *ctx = (demux_ctx_t *)args;
+    uint32_t gen;
+    int audio_task = 0;
+#ifdef CONFIG_VIDEO
+    int video_task = 0;
+#endif
 
     DBG_I("Waiting\n");
     msleep_wait(ctx->pause, MSLEEP_INFINITE_WAIT);
     DBG_I("Start demux task\n");
 
-    frame = av_frame_alloc();
-    if (!frame)
+    /* Every stream is decoded by own task. A stalled video never starves an audio */
+    if (ctx->audio_ctx)
     {
-        DBG_E("Could not allocate frame\n");
-        return NULL;
+        if (pthread_create(&ctx->audio_ctx->task, NULL, audio_decode_routine, ctx))
+            DBG_E("Unable to create audio decode task\n");
+        else
+            audio_task = 1;
     }
+#ifdef CONFIG_VIDEO
+    if (ctx->video_ctx)
+    {
+        if (pthread_create(&ctx->video_ctx->task, NULL, video_decode_routine, ctx))
+            DBG_E("Unable to create video decode task\n");
+        else
+            video_task = 1;
+    }
+#endif
 
     /* initialize packet, set data to NULL, let the demuxer fill it */
     av_init_packet(&pkt);
@@ -1557,32 +2798,43 @@ static void *read_demux_data(void *args)
     /* read frames from the file */
     while (!ctx->stop_decode)
     {
-        AVPacket orig_pkt;
-
         decode_lock(ctx);
+        trace_begin(&span, "av_read_frame", TRACE_NOPTS);
         if (av_read_frame(ctx->fmt_ctx, &pkt) < 0)
         {
+            trace_end(&span);
             decode_unlock(ctx);
             break;
         }
+        span.pts = ts2ms(&ctx->fmt_ctx->streams[pkt.stream_index]->time_base, pkt.pts);
+        trace_end(&span);
+        /* Read under the lock taken by a seek, so the packet is tagged with the position it comes from */
+        gen = ctx->seek_gen;
         decode_unlock(ctx);
-        orig_pkt = pkt;
-        do
-        {
-            ret = decode_packet(&got_frame, 0, ctx, frame, &pkt);
-            if (ret < 0)
-                break;
-            pkt.data += ret;
-            pkt.size -= ret;
-        }
-        while (pkt.size > 0);
 
-        av_free_packet(&orig_pkt);
+#ifdef CONFIG_VIDEO
+        if (video_task && pkt.stream_index == ctx->video_ctx->stream_idx)
+            push_packet(ctx, ctx->video_ctx->pkt_free, ctx->video_ctx->pkt_fill, &pkt, gen);
+        else if (ctx->video_ctx && pkt.stream_index == ctx->video_ctx->subtitle_stream_idx)
+            decode_subtitle_packet(ctx->video_ctx, &pkt);
+        else
+#endif
+        if (audio_task && pkt.stream_index == ctx->audio_ctx->stream_idx)
+            push_packet(ctx, ctx->audio_ctx->pkt_free, ctx->audio_ctx->pkt_fill, &pkt, gen);
+
+        av_packet_unref(&pkt);
     }
+    ctx->demux_eof = 1;
 
-    printf("\n");
+    DBG_I("Waiting for decode tasks\n");
+    if (audio_task)
+        pthread_join(ctx->audio_ctx->task, NULL);
+#ifdef CONFIG_VIDEO
+    if (video_task)
+        pthread_join(ctx->video_ctx->task, NULL);
+#endif
 
-    av_frame_free(&frame);
+    printf("\n");
 
     DBG_I("Stop demux task\n");
 
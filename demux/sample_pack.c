@@ -0,0 +1,312 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SAMPLE_PACK_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAMPLE_PACK_NEON
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "sample_pack.h"
+
+/* Float samples are scaled by 2^15 and clipped to S16 range */
+#define S16_SCALE   32768.0f
+#define S16_MAX_F   32767.0f
+#define S16_MIN_F   -32768.0f
+
+typedef void (*pack_row_t)(const void *left, const void *right, void *dst, int x, int nb_samples);
+
+static pack_row_t fltp_flt_row;
+static pack_row_t fltp_s16_row;
+static pack_row_t s16p_s16_row;
+
+static inline int16_t flt2s16(float val)
+{
+    val *= S16_SCALE;
+    val = (val > S16_MAX_F) ? S16_MAX_F : (val < S16_MIN_F) ? S16_MIN_F : val;
+
+    return (int16_t)(val + ((val < 0) ? -0.5f : 0.5f));
+}
+
+/* Convert samples from x to the end. Used for tails of SIMD rows too */
+static void fltp_flt_row_c(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    float *d = dst;
+
+    for (; x < nb_samples; x++)
+    {
+        d[2 * x] = l[x];
+        d[2 * x + 1] = r[x];
+    }
+}
+
+static void fltp_s16_row_c(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    int16_t *d = dst;
+
+    for (; x < nb_samples; x++)
+    {
+        d[2 * x] = flt2s16(l[x]);
+        d[2 * x + 1] = flt2s16(r[x]);
+    }
+}
+
+static void s16p_s16_row_c(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const int16_t *l = left, *r = right;
+    int16_t *d = dst;
+
+    for (; x < nb_samples; x++)
+    {
+        d[2 * x] = l[x];
+        d[2 * x + 1] = r[x];
+    }
+}
+
+#ifdef SAMPLE_PACK_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+
+TARGET_SSE2 static void fltp_flt_row_sse2(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    float *d = dst;
+    __m128 vl, vr;
+
+    for (; x + 4 <= nb_samples; x += 4)
+    {
+        vl = _mm_loadu_ps(l + x);
+        vr = _mm_loadu_ps(r + x);
+        _mm_storeu_ps(d + 2 * x, _mm_unpacklo_ps(vl, vr));
+        _mm_storeu_ps(d + 2 * x + 4, _mm_unpackhi_ps(vl, vr));
+    }
+    fltp_flt_row_c(left, right, dst, x, nb_samples);
+}
+
+/* Same math as flt2s16: scale, clip, add 0.5 with the sign of the value and truncate */
+TARGET_SSE2 static inline __m128i flt2s32_sse2(__m128 val)
+{
+    __m128 sign = _mm_and_ps(val, _mm_set1_ps(-0.0f));
+
+    val = _mm_mul_ps(val, _mm_set1_ps(S16_SCALE));
+    val = _mm_max_ps(_mm_min_ps(val, _mm_set1_ps(S16_MAX_F)), _mm_set1_ps(S16_MIN_F));
+
+    return _mm_cvttps_epi32(_mm_add_ps(val, _mm_or_ps(_mm_set1_ps(0.5f), sign)));
+}
+
+TARGET_SSE2 static void fltp_s16_row_sse2(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    int16_t *d = dst;
+    __m128i vl, vr;
+
+    for (; x + 8 <= nb_samples; x += 8)
+    {
+        vl = _mm_packs_epi32(flt2s32_sse2(_mm_loadu_ps(l + x)), flt2s32_sse2(_mm_loadu_ps(l + x + 4)));
+        vr = _mm_packs_epi32(flt2s32_sse2(_mm_loadu_ps(r + x)), flt2s32_sse2(_mm_loadu_ps(r + x + 4)));
+        _mm_storeu_si128((__m128i *)(d + 2 * x), _mm_unpacklo_epi16(vl, vr));
+        _mm_storeu_si128((__m128i *)(d + 2 * x + 8), _mm_unpackhi_epi16(vl, vr));
+    }
+    fltp_s16_row_c(left, right, dst, x, nb_samples);
+}
+
+TARGET_SSE2 static void s16p_s16_row_sse2(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const int16_t *l = left, *r = right;
+    int16_t *d = dst;
+    __m128i vl, vr;
+
+    for (; x + 8 <= nb_samples; x += 8)
+    {
+        vl = _mm_loadu_si128((const __m128i *)(l + x));
+        vr = _mm_loadu_si128((const __m128i *)(r + x));
+        _mm_storeu_si128((__m128i *)(d + 2 * x), _mm_unpacklo_epi16(vl, vr));
+        _mm_storeu_si128((__m128i *)(d + 2 * x + 8), _mm_unpackhi_epi16(vl, vr));
+    }
+    s16p_s16_row_c(left, right, dst, x, nb_samples);
+}
+#endif
+
+#ifdef SAMPLE_PACK_NEON
+static void fltp_flt_row_neon(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    float *d = dst;
+    float32x4x2_t v;
+
+    for (; x + 4 <= nb_samples; x += 4)
+    {
+        v.val[0] = vld1q_f32(l + x);
+        v.val[1] = vld1q_f32(r + x);
+        vst2q_f32(d + 2 * x, v);
+    }
+    fltp_flt_row_c(left, right, dst, x, nb_samples);
+}
+
+/* Same math as flt2s16. vcvtq_s32_f32 truncates towards zero */
+static inline int16x4_t flt2s16_neon(float32x4_t val)
+{
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(val), vdupq_n_u32(0x80000000));
+
+    val = vmulq_n_f32(val, S16_SCALE);
+    val = vmaxq_f32(vminq_f32(val, vdupq_n_f32(S16_MAX_F)), vdupq_n_f32(S16_MIN_F));
+    val = vaddq_f32(val, vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)), sign)));
+
+    return vqmovn_s32(vcvtq_s32_f32(val));
+}
+
+static void fltp_s16_row_neon(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const float *l = left, *r = right;
+    int16_t *d = dst;
+    int16x8x2_t v;
+
+    for (; x + 8 <= nb_samples; x += 8)
+    {
+        v.val[0] = vcombine_s16(flt2s16_neon(vld1q_f32(l + x)), flt2s16_neon(vld1q_f32(l + x + 4)));
+        v.val[1] = vcombine_s16(flt2s16_neon(vld1q_f32(r + x)), flt2s16_neon(vld1q_f32(r + x + 4)));
+        vst2q_s16(d + 2 * x, v);
+    }
+    fltp_s16_row_c(left, right, dst, x, nb_samples);
+}
+
+static void s16p_s16_row_neon(const void *left, const void *right, void *dst, int x, int nb_samples)
+{
+    const int16_t *l = left, *r = right;
+    int16_t *d = dst;
+    int16x8x2_t v;
+
+    for (; x + 8 <= nb_samples; x += 8)
+    {
+        v.val[0] = vld1q_s16(l + x);
+        v.val[1] = vld1q_s16(r + x);
+        vst2q_s16(d + 2 * x, v);
+    }
+    s16p_s16_row_c(left, right, dst, x, nb_samples);
+}
+#endif
+
+static void pack_fltp_flt(uint8_t *const src[], uint8_t *dst, int nb_samples)
+{
+    fltp_flt_row(src[0], src[1], dst, 0, nb_samples);
+}
+
+static void pack_fltp_s16(uint8_t *const src[], uint8_t *dst, int nb_samples)
+{
+    fltp_s16_row(src[0], src[1], dst, 0, nb_samples);
+}
+
+static void pack_s16p_s16(uint8_t *const src[], uint8_t *dst, int nb_samples)
+{
+    s16p_s16_row(src[0], src[1], dst, 0, nb_samples);
+}
+
+static const char *isa_names[] = { "auto", "C", "SSE2", "NEON" };
+
+static int set_rows(sample_pack_isa_t isa)
+{
+    switch (isa)
+    {
+    case SAMPLE_PACK_ISA_C:
+        fltp_flt_row = fltp_flt_row_c;
+        fltp_s16_row = fltp_s16_row_c;
+        s16p_s16_row = s16p_s16_row_c;
+        return 1;
+#ifdef SAMPLE_PACK_X86
+    case SAMPLE_PACK_ISA_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return 0;
+        fltp_flt_row = fltp_flt_row_sse2;
+        fltp_s16_row = fltp_s16_row_sse2;
+        s16p_s16_row = s16p_s16_row_sse2;
+        return 1;
+#endif
+#ifdef SAMPLE_PACK_NEON
+    case SAMPLE_PACK_ISA_NEON:
+        fltp_flt_row = fltp_flt_row_neon;
+        fltp_s16_row = fltp_s16_row_neon;
+        s16p_s16_row = s16p_s16_row_neon;
+        return 1;
+#endif
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void select_rows(void)
+{
+    if (fltp_flt_row)
+        return;
+
+    sample_pack_set_isa(SAMPLE_PACK_ISA_AUTO);
+}
+
+ret_code_t sample_pack_set_isa(sample_pack_isa_t isa)
+{
+    int i;
+
+    if (isa == SAMPLE_PACK_ISA_AUTO)
+    {
+        /* The best one goes last */
+        for (i = SAMPLE_PACK_ISA_NEON; i > SAMPLE_PACK_ISA_C; i--)
+        {
+            if (set_rows((sample_pack_isa_t)i))
+                break;
+        }
+        isa = (sample_pack_isa_t)i;
+        if (isa == SAMPLE_PACK_ISA_C)
+            set_rows(isa);
+    }
+    else if (!set_rows(isa))
+    {
+        return L_FAILED;
+    }
+    DBG_I("Planar to packed samples conversion: %s\n", isa_names[isa]);
+
+    return L_OK;
+}
+
+sample_pack_func_t sample_pack_get_func(enum AVSampleFormat src_fmt, enum AVSampleFormat dst_fmt)
+{
+    if (src_fmt == AV_SAMPLE_FMT_FLTP && dst_fmt == AV_SAMPLE_FMT_FLT)
+    {
+        select_rows();
+        return pack_fltp_flt;
+    }
+    if (src_fmt == AV_SAMPLE_FMT_FLTP && dst_fmt == AV_SAMPLE_FMT_S16)
+    {
+        select_rows();
+        return pack_fltp_s16;
+    }
+    if (src_fmt == AV_SAMPLE_FMT_S16P && dst_fmt == AV_SAMPLE_FMT_S16)
+    {
+        select_rows();
+        return pack_s16p_s16;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,361 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <libavutil/common.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+
+#include "log.h"
+#include "video_scale.h"
+#include "yuv2rgb.h"
+#include "trace.h"
+
+#define SCALE_MAX_WORKERS   8
+/* Upper limit when the amount is detected automatically */
+#define SCALE_AUTO_WORKERS  4
+/* Do not split frames to bands smaller than this */
+#define SCALE_MIN_BAND      64
+
+struct scale_ctx_s;
+
+typedef struct {
+    struct SwsContext *sws;
+    struct scale_ctx_s *parent;
+    pthread_t task;
+    sem_t start;
+    int rc;
+
+    /* First row and height of the band in source and destination images */
+    int src_y;
+    int src_h;
+    int dst_y;
+    int dst_h;
+} band_t;
+
+typedef struct scale_ctx_s {
+    band_t bands[SCALE_MAX_WORKERS];
+    /* Worker threads, created once. Amount of bands of the current conversion may be less */
+    int workers;
+    int count;
+    int stop;
+    sem_t done;
+
+    const AVPixFmtDescriptor *src_desc;
+    const AVPixFmtDescriptor *dst_desc;
+    int src_planes;
+    int dst_planes;
+    int width;
+    /* In-tree converter used instead of swscale when formats allow */
+    yuv2rgb_func_t yuv2rgb;
+
+    /* Frame under conversion */
+    uint8_t *const *src;
+    const int *src_stride;
+    uint8_t *const *dst;
+    const int *dst_stride;
+
+    int last_us;
+    int avg_us;
+} scale_ctx_t;
+
+/* Offset of the row in the plane. Chroma planes are vertically subsampled */
+static int plane_offset(const AVPixFmtDescriptor *desc, int plane, int y, int stride)
+{
+    if (plane == 1 || plane == 2)
+        y >>= desc->log2_chroma_h;
+
+    return y * stride;
+}
+
+static int scale_band(scale_ctx_t *ctx, band_t *band)
+{
+    const uint8_t *src[4];
+    uint8_t *dst[4];
+    trace_span_t span;
+    int i, rc;
+
+    /* Planes not used by a format (a palette for example) are passed as is */
+    for (i = 0; i < 4; i++)
+    {
+        src[i] = ctx->src[i];
+        dst[i] = ctx->dst[i];
+    }
+    for (i = 0; i < ctx->src_planes; i++)
+        src[i] += plane_offset(ctx->src_desc, i, band->src_y, ctx->src_stride[i]);
+    for (i = 0; i < ctx->dst_planes; i++)
+        dst[i] += plane_offset(ctx->dst_desc, i, band->dst_y, ctx->dst_stride[i]);
+
+    if (ctx->yuv2rgb)
+    {
+        trace_begin(&span, "yuv2rgb", TRACE_NOPTS);
+        ctx->yuv2rgb((uint8_t *const *)src, ctx->src_stride, dst[0], ctx->dst_stride[0], ctx->width, band->src_h);
+        trace_end(&span);
+        return band->src_h;
+    }
+
+    trace_begin(&span, "sws_scale", TRACE_NOPTS);
+    rc = sws_scale(band->sws, src, ctx->src_stride, 0, band->src_h, dst, ctx->dst_stride);
+    trace_end(&span);
+
+    return rc;
+}
+
+static void *scale_routine(void *args)
+{
+    band_t *band = (band_t *)args;
+    scale_ctx_t *ctx = band->parent;
+
+    while (1)
+    {
+        sem_wait(&band->start);
+        if (ctx->stop)
+            break;
+
+        band->rc = scale_band(ctx, band);
+        sem_post(&ctx->done);
+    }
+
+    return NULL;
+}
+
+static int get_workers_count(int workers)
+{
+    long cpus;
+
+    if (!workers)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cpus < 1) ? 1 : (cpus > SCALE_AUTO_WORKERS) ? SCALE_AUTO_WORKERS : cpus;
+    }
+    if (workers > SCALE_MAX_WORKERS)
+        workers = SCALE_MAX_WORKERS;
+
+    return workers;
+}
+
+static void free_bands(scale_ctx_t *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->count; i++)
+    {
+        if (ctx->bands[i].sws)
+            sws_freeContext(ctx->bands[i].sws);
+        ctx->bands[i].sws = NULL;
+    }
+    ctx->count = 0;
+}
+
+/* Split the conversion to bands and create their contexts. Called while workers are idle */
+static ret_code_t setup_bands(scale_ctx_t *ctx, video_scale_fmt_t *src, video_scale_fmt_t *dst)
+{
+    band_t *band;
+    int i, align, next;
+
+    free_bands(ctx);
+
+    ctx->src_desc = av_pix_fmt_desc_get(src->pix_fmt);
+    ctx->dst_desc = av_pix_fmt_desc_get(dst->pix_fmt);
+    if (!ctx->src_desc || !ctx->dst_desc)
+    {
+        DBG_E("Unknown pixel format\n");
+        return L_FAILED;
+    }
+    ctx->src_planes = av_pix_fmt_count_planes(src->pix_fmt);
+    ctx->dst_planes = av_pix_fmt_count_planes(dst->pix_fmt);
+    ctx->width = dst->width;
+    ctx->yuv2rgb = NULL;
+    if (src->width == dst->width && src->height == dst->height)
+        ctx->yuv2rgb = yuv2rgb_get_func(src->pix_fmt, dst->pix_fmt);
+
+    /* Bands have to start from a row of chroma planes */
+    align = 1 << FFMAX(ctx->src_desc->log2_chroma_h, ctx->dst_desc->log2_chroma_h);
+
+    /*
+     * A vertical filter of a band context can not see rows of neighbour bands and rounds the scale ratio of its
+     * own band. Scaled heights are converted as a whole frame to avoid seams.
+     */
+    ctx->count = (src->height == dst->height) ? ctx->workers : 1;
+    if (ctx->count > dst->height / SCALE_MIN_BAND)
+        ctx->count = FFMAX(dst->height / SCALE_MIN_BAND, 1);
+
+    for (i = 0; i < ctx->count; i++)
+    {
+        band = &ctx->bands[i];
+
+        band->dst_y = (dst->height * i / ctx->count) & ~(align - 1);
+        next = (i == ctx->count - 1) ? dst->height : (dst->height * (i + 1) / ctx->count) & ~(align - 1);
+        band->dst_h = next - band->dst_y;
+
+        band->src_y = ((int64_t)band->dst_y * src->height / dst->height) & ~(align - 1);
+        next = (i == ctx->count - 1) ? src->height :
+            ((int64_t)(band->dst_y + band->dst_h) * src->height / dst->height) & ~(align - 1);
+        band->src_h = next - band->src_y;
+
+        if (ctx->yuv2rgb)
+            continue;
+
+        band->sws = sws_getContext(src->width, band->src_h, src->pix_fmt, dst->width, band->dst_h,
+            dst->pix_fmt, SWS_BILINEAR, NULL, NULL, NULL);
+        if (!band->sws)
+        {
+            DBG_E("Can not allocate scale format\n");
+            free_bands(ctx);
+            return L_FAILED;
+        }
+    }
+    DBG_I("Video conversion %s %dx%d -> %s %dx%d in %d band(s) by %s\n", ctx->src_desc->name, src->width,
+        src->height, ctx->dst_desc->name, dst->width, dst->height, ctx->count, ctx->yuv2rgb ? "yuv2rgb" : "swscale");
+
+    return L_OK;
+}
+
+ret_code_t video_scale_init(video_scale_h *h, video_scale_fmt_t *src, video_scale_fmt_t *dst, int workers)
+{
+    scale_ctx_t *ctx;
+    band_t *band;
+    int i;
+
+    ctx = (scale_ctx_t *)malloc(sizeof(scale_ctx_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(scale_ctx_t));
+    sem_init(&ctx->done, 0, 0);
+
+    ctx->workers = get_workers_count(workers);
+    for (i = 0; i < ctx->workers; i++)
+    {
+        band = &ctx->bands[i];
+        band->parent = ctx;
+        sem_init(&band->start, 0, 0);
+
+        /* The first band is converted by the caller */
+        if (i && pthread_create(&band->task, NULL, scale_routine, band))
+        {
+            DBG_E("Create thread falled\n");
+            goto Error;
+        }
+    }
+
+    if (setup_bands(ctx, src, dst))
+        goto Error;
+
+    *h = ctx;
+
+    return L_OK;
+
+Error:
+    video_scale_uninit(ctx);
+    return L_FAILED;
+}
+
+ret_code_t video_scale_set_size(video_scale_h h, video_scale_fmt_t *src, video_scale_fmt_t *dst)
+{
+    scale_ctx_t *ctx = (scale_ctx_t *)h;
+
+    return setup_bands(ctx, src, dst);
+}
+
+void video_scale_uninit(video_scale_h h)
+{
+    scale_ctx_t *ctx = (scale_ctx_t *)h;
+    band_t *band;
+    int i;
+
+    if (!ctx)
+        return;
+
+    free_bands(ctx);
+    ctx->stop = 1;
+    for (i = 0; i < ctx->workers; i++)
+    {
+        band = &ctx->bands[i];
+        if (!band->parent)
+            break;
+        if (band->task)
+        {
+            sem_post(&band->start);
+            pthread_join(band->task, NULL);
+        }
+        sem_destroy(&band->start);
+    }
+    sem_destroy(&ctx->done);
+
+    free(ctx);
+}
+
+ret_code_t video_scale_frame(video_scale_h h, uint8_t *const src[], const int src_stride[], uint8_t *const dst[],
+    const int dst_stride[])
+{
+    scale_ctx_t *ctx = (scale_ctx_t *)h;
+    struct timespec start, end;
+    ret_code_t rc = L_OK;
+    int i;
+
+    /* Setup of the last size failed */
+    if (!ctx->count)
+        return L_FAILED;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ctx->src = src;
+    ctx->src_stride = src_stride;
+    ctx->dst = dst;
+    ctx->dst_stride = dst_stride;
+
+    for (i = 1; i < ctx->count; i++)
+        sem_post(&ctx->bands[i].start);
+
+    ctx->bands[0].rc = scale_band(ctx, &ctx->bands[0]);
+
+    for (i = 1; i < ctx->count; i++)
+        sem_wait(&ctx->done);
+
+    for (i = 0; i < ctx->count; i++)
+    {
+        if (ctx->bands[i].rc < 0)
+        {
+            DBG_E("sws_scale failed on band %d\n", i);
+            rc = L_FAILED;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ctx->last_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    ctx->avg_us = ctx->avg_us ? (ctx->avg_us * 15 + ctx->last_us) / 16 : ctx->last_us;
+
+    return rc;
+}
+
+void video_scale_get_time(video_scale_h h, int *last_us, int *avg_us)
+{
+    scale_ctx_t *ctx = (scale_ctx_t *)h;
+
+    *last_us = ctx ? ctx->last_us : 0;
+    *avg_us = ctx ? ctx->avg_us : 0;
+}
@@ -0,0 +1,422 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV2RGB_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV2RGB_NEON
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "yuv2rgb.h"
+
+/*
+ * Fixed point BT.601 coefficients scaled by 64. All intermediate values fit to 16 bits, so SIMD code uses the
+ * same math as the C code. Luma is multiplied by 74.5 as y * 74 + y / 2 and carries the rounding constant.
+ */
+#define YUV_SHIFT   6
+#define YUV_ROUND   (1 << (YUV_SHIFT - 1))
+#define Y_COEF      74  /* 1.164 */
+#define RV_COEF     102 /* 1.596 */
+#define GU_COEF     25  /* 0.391 */
+#define GV_COEF     52  /* 0.813 */
+#define BU_COEF     129 /* 2.018 */
+
+typedef void (*yuv420p_row_t)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width);
+typedef void (*nv12_row_t)(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width);
+
+static yuv420p_row_t yuv420p_row;
+static nv12_row_t nv12_row;
+
+static inline uint8_t clip_uint8(int val)
+{
+    return (val < 0) ? 0 : (val > 255) ? 255 : val;
+}
+
+static inline void yuv_pixel(int y, int u, int v, uint8_t *dst)
+{
+    y -= 16;
+    y = y * Y_COEF + (y >> 1) + YUV_ROUND;
+    u -= 128;
+    v -= 128;
+
+    dst[0] = clip_uint8((y + RV_COEF * v) >> YUV_SHIFT);
+    dst[1] = clip_uint8((y - GU_COEF * u - GV_COEF * v) >> YUV_SHIFT);
+    dst[2] = clip_uint8((y + BU_COEF * u) >> YUV_SHIFT);
+    dst[3] = 0xff;
+}
+
+/* Convert pixels from x to the end of the row. Used for tails of SIMD rows too */
+static void yuv420p_tail(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int x, int width)
+{
+    for (; x < width; x++)
+        yuv_pixel(y[x], u[x >> 1], v[x >> 1], dst + 4 * x);
+}
+
+static void nv12_tail(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int x, int width)
+{
+    for (; x < width; x++)
+        yuv_pixel(y[x], uv[x & ~1], uv[x | 1], dst + 4 * x);
+}
+
+static void yuv420p_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width)
+{
+    yuv420p_tail(y, u, v, dst, 0, width);
+}
+
+static void nv12_row_c(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width)
+{
+    nv12_tail(y, uv, dst, 0, width);
+}
+
+#ifdef YUV2RGB_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+/* y, u and v are 16 bit values. u and v without the 128 offset */
+TARGET_SSE2 static inline void yuv2rgb_sse2(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    y = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(y, _mm_set1_epi16(Y_COEF)), _mm_srai_epi16(y, 1)),
+        _mm_set1_epi16(YUV_ROUND));
+
+    *r = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(RV_COEF))), YUV_SHIFT);
+    *g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(GU_COEF))),
+        _mm_mullo_epi16(v, _mm_set1_epi16(GV_COEF))), YUV_SHIFT);
+    *b = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(BU_COEF))), YUV_SHIFT);
+}
+
+/* u and v are 8 chroma values for 16 pixels */
+TARGET_SSE2 static inline void convert16_sse2(const uint8_t *src, __m128i u, __m128i v, uint8_t *dst)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i alpha = _mm_set1_epi8(-1);
+    __m128i y, r0, g0, b0, r1, g1, b1, r, g, b, rg, ba;
+
+    y = _mm_loadu_si128((const __m128i *)src);
+    yuv2rgb_sse2(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v), &r0, &g0, &b0);
+    yuv2rgb_sse2(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v), &r1, &g1, &b1);
+
+    r = _mm_packus_epi16(r0, r1);
+    g = _mm_packus_epi16(g0, g1);
+    b = _mm_packus_epi16(b0, b1);
+
+    rg = _mm_unpacklo_epi8(r, g);
+    ba = _mm_unpacklo_epi8(b, alpha);
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+    rg = _mm_unpackhi_epi8(r, g);
+    ba = _mm_unpackhi_epi8(b, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(rg, ba));
+}
+
+TARGET_SSE2 static void yuv420p_row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+    int width)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i offset = _mm_set1_epi16(128);
+    __m128i cu, cv;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+        cu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + x / 2)), zero), offset);
+        cv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + x / 2)), zero), offset);
+        convert16_sse2(y + x, cu, cv, dst + 4 * x);
+    }
+    yuv420p_tail(y, u, v, dst, x, width);
+}
+
+TARGET_SSE2 static void nv12_row_sse2(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width)
+{
+    __m128i mask = _mm_set1_epi16(0xff);
+    __m128i offset = _mm_set1_epi16(128);
+    __m128i c;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+        c = _mm_loadu_si128((const __m128i *)(uv + x));
+        convert16_sse2(y + x, _mm_sub_epi16(_mm_and_si128(c, mask), offset),
+            _mm_sub_epi16(_mm_srli_epi16(c, 8), offset), dst + 4 * x);
+    }
+    nv12_tail(y, uv, dst, x, width);
+}
+
+TARGET_AVX2 static inline void yuv2rgb_avx2(__m256i y, __m256i u, __m256i v, __m256i *r, __m256i *g, __m256i *b)
+{
+    y = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+    y = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(y, _mm256_set1_epi16(Y_COEF)), _mm256_srai_epi16(y, 1)),
+        _mm256_set1_epi16(YUV_ROUND));
+
+    *r = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(RV_COEF))), YUV_SHIFT);
+    *g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y, _mm256_mullo_epi16(u,
+        _mm256_set1_epi16(GU_COEF))), _mm256_mullo_epi16(v, _mm256_set1_epi16(GV_COEF))), YUV_SHIFT);
+    *b = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(BU_COEF))), YUV_SHIFT);
+}
+
+/* 8 chroma values to 16 values, one per pixel */
+TARGET_AVX2 static inline __m256i dup_chroma_avx2(__m128i c)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(c, c)), _mm_unpackhi_epi16(c, c), 1);
+}
+
+/* u0, v0 - chroma of pixels 0..15, u1, v1 - 16..31 */
+TARGET_AVX2 static inline void convert32_avx2(const uint8_t *src, __m128i u0, __m128i v0, __m128i u1, __m128i v1,
+    uint8_t *dst)
+{
+    __m256i alpha = _mm256_set1_epi8(-1);
+    __m256i y0, y1, r0, g0, b0, r1, g1, b1, r, g, b, rg_lo, rg_hi, ba_lo, ba_hi, p0, p1, p2, p3;
+
+    y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src));
+    y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + 16)));
+    yuv2rgb_avx2(y0, dup_chroma_avx2(u0), dup_chroma_avx2(v0), &r0, &g0, &b0);
+    yuv2rgb_avx2(y1, dup_chroma_avx2(u1), dup_chroma_avx2(v1), &r1, &g1, &b1);
+
+    /* Pack works inside 128 bit lanes. Restore the pixels order */
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xd8);
+    g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xd8);
+    b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b0, b1), 0xd8);
+
+    rg_lo = _mm256_unpacklo_epi8(r, g);
+    rg_hi = _mm256_unpackhi_epi8(r, g);
+    ba_lo = _mm256_unpacklo_epi8(b, alpha);
+    ba_hi = _mm256_unpackhi_epi8(b, alpha);
+
+    /* Low lanes hold pixels 0..15, high lanes 16..31 */
+    p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+    p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+    p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+    p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+
+    _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+    _mm256_storeu_si256((__m256i *)(dst + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+TARGET_AVX2 static void yuv420p_row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+    int width)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i offset = _mm_set1_epi16(128);
+    __m128i cu, cv;
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32)
+    {
+        cu = _mm_loadu_si128((const __m128i *)(u + x / 2));
+        cv = _mm_loadu_si128((const __m128i *)(v + x / 2));
+        convert32_avx2(y + x, _mm_sub_epi16(_mm_unpacklo_epi8(cu, zero), offset),
+            _mm_sub_epi16(_mm_unpacklo_epi8(cv, zero), offset), _mm_sub_epi16(_mm_unpackhi_epi8(cu, zero), offset),
+            _mm_sub_epi16(_mm_unpackhi_epi8(cv, zero), offset), dst + 4 * x);
+    }
+    yuv420p_tail(y, u, v, dst, x, width);
+}
+
+TARGET_AVX2 static void nv12_row_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width)
+{
+    __m128i mask = _mm_set1_epi16(0xff);
+    __m128i offset = _mm_set1_epi16(128);
+    __m128i c0, c1;
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32)
+    {
+        c0 = _mm_loadu_si128((const __m128i *)(uv + x));
+        c1 = _mm_loadu_si128((const __m128i *)(uv + x + 16));
+        convert32_avx2(y + x, _mm_sub_epi16(_mm_and_si128(c0, mask), offset),
+            _mm_sub_epi16(_mm_srli_epi16(c0, 8), offset), _mm_sub_epi16(_mm_and_si128(c1, mask), offset),
+            _mm_sub_epi16(_mm_srli_epi16(c1, 8), offset), dst + 4 * x);
+    }
+    nv12_tail(y, uv, dst, x, width);
+}
+#endif
+
+#ifdef YUV2RGB_NEON
+static inline void convert8_neon(uint8x8_t y8, uint8x8_t u8, uint8x8_t v8, uint8_t *dst)
+{
+    int16x8_t y, u, v;
+    uint8x8x4_t px;
+
+    y = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16));
+    y = vaddq_s16(vaddq_s16(vmulq_n_s16(y, Y_COEF), vshrq_n_s16(y, 1)), vdupq_n_s16(YUV_ROUND));
+    u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128));
+    v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128));
+
+    px.val[0] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(v, RV_COEF)), YUV_SHIFT));
+    px.val[1] = vqmovun_s16(vshrq_n_s16(vqsubq_s16(vqsubq_s16(y, vmulq_n_s16(u, GU_COEF)),
+        vmulq_n_s16(v, GV_COEF)), YUV_SHIFT));
+    px.val[2] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(u, BU_COEF)), YUV_SHIFT));
+    px.val[3] = vdup_n_u8(0xff);
+
+    vst4_u8(dst, px);
+}
+
+/* u and v are 8 chroma values for 16 pixels */
+static inline void convert16_neon(const uint8_t *src, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+    uint8x16_t y = vld1q_u8(src);
+    uint8x8x2_t ud = vzip_u8(u, u);
+    uint8x8x2_t vd = vzip_u8(v, v);
+
+    convert8_neon(vget_low_u8(y), ud.val[0], vd.val[0], dst);
+    convert8_neon(vget_high_u8(y), ud.val[1], vd.val[1], dst + 32);
+}
+
+static void yuv420p_row_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width)
+{
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+        convert16_neon(y + x, vld1_u8(u + x / 2), vld1_u8(v + x / 2), dst + 4 * x);
+
+    yuv420p_tail(y, u, v, dst, x, width);
+}
+
+static void nv12_row_neon(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width)
+{
+    uint8x8x2_t c;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+        c = vld2_u8(uv + x);
+        convert16_neon(y + x, c.val[0], c.val[1], dst + 4 * x);
+    }
+    nv12_tail(y, uv, dst, x, width);
+}
+#endif
+
+static void convert_yuv420p(uint8_t *const src[], const int src_stride[], uint8_t *dst, int dst_stride, int width,
+    int height)
+{
+    int j;
+
+    for (j = 0; j < height; j++)
+    {
+        yuv420p_row(src[0] + j * src_stride[0], src[1] + (j >> 1) * src_stride[1], src[2] + (j >> 1) * src_stride[2],
+            dst + j * dst_stride, width);
+    }
+}
+
+static void convert_nv12(uint8_t *const src[], const int src_stride[], uint8_t *dst, int dst_stride, int width,
+    int height)
+{
+    int j;
+
+    for (j = 0; j < height; j++)
+        nv12_row(src[0] + j * src_stride[0], src[1] + (j >> 1) * src_stride[1], dst + j * dst_stride, width);
+}
+
+static const char *isa_names[] = { "auto", "C", "SSE2", "AVX2", "NEON" };
+
+static int set_rows(yuv2rgb_isa_t isa)
+{
+    switch (isa)
+    {
+    case YUV2RGB_ISA_C:
+        yuv420p_row = yuv420p_row_c;
+        nv12_row = nv12_row_c;
+        return 1;
+#ifdef YUV2RGB_X86
+    case YUV2RGB_ISA_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return 0;
+        yuv420p_row = yuv420p_row_sse2;
+        nv12_row = nv12_row_sse2;
+        return 1;
+    case YUV2RGB_ISA_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return 0;
+        yuv420p_row = yuv420p_row_avx2;
+        nv12_row = nv12_row_avx2;
+        return 1;
+#endif
+#ifdef YUV2RGB_NEON
+    case YUV2RGB_ISA_NEON:
+        yuv420p_row = yuv420p_row_neon;
+        nv12_row = nv12_row_neon;
+        return 1;
+#endif
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static void select_rows(void)
+{
+    if (yuv420p_row)
+        return;
+
+    yuv2rgb_set_isa(YUV2RGB_ISA_AUTO);
+}
+
+ret_code_t yuv2rgb_set_isa(yuv2rgb_isa_t isa)
+{
+    int i;
+
+    if (isa == YUV2RGB_ISA_AUTO)
+    {
+        /* The best one goes last */
+        for (i = YUV2RGB_ISA_NEON; i > YUV2RGB_ISA_C; i--)
+        {
+            if (set_rows((yuv2rgb_isa_t)i))
+                break;
+        }
+        isa = (yuv2rgb_isa_t)i;
+        if (isa == YUV2RGB_ISA_C)
+            set_rows(isa);
+    }
+    else if (!set_rows(isa))
+    {
+        return L_FAILED;
+    }
+    DBG_I("YUV to RGBA conversion: %s\n", isa_names[isa]);
+
+    return L_OK;
+}
+
+yuv2rgb_func_t yuv2rgb_get_func(enum AVPixelFormat src_fmt, enum AVPixelFormat dst_fmt)
+{
+    if (dst_fmt != AV_PIX_FMT_RGBA)
+        return NULL;
+
+    switch (src_fmt)
+    {
+    case AV_PIX_FMT_YUV420P:
+        select_rows();
+        return convert_yuv420p;
+    case AV_PIX_FMT_NV12:
+        select_rows();
+        return convert_nv12;
+    default:
+        break;
+    }
+
+    return NULL;
+}
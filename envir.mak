@@ -61,6 +61,10 @@ ifdef CONFIG_PULSE_AUDIO
 LDFLAGS += -lpulse -lpulse-simple
 endif
 
+ifdef CONFIG_ALSA_AUDIO
+LDFLAGS += -lasound
+endif
+
 ifdef CONFIG_OPENGL_VIDEO
 LDFLAGS += -lGL -lGLU -lglut -lGLEW
 endif
@@ -29,11 +29,19 @@
 
 typedef void* audio_player_h;
 
+typedef struct {
+    /* Output latency requested from the audio server in ms. 0 - server default */
+    int latency_ms;
+    /* Output device name, NULL - the default one. Used by ALSA player only */
+    const char *device;
+} audio_player_params_t;
+
 #ifdef CONFIG_RASPBERRY_PI
 OMX_ERRORTYPE audio_play_buffer_done(OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_BUFFERHEADERTYPE* pBuffer);
 #endif
 
-ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock);
+ret_code_t audio_player_start(audio_player_h *player_ctx, demux_ctx_h h, void *clock,
+    audio_player_params_t *params);
 void audio_player_stop(audio_player_h player_ctx, int stop);
 int audio_player_pause_toggle(audio_player_h player_ctx);
 ret_code_t audio_player_mute_toggle(audio_player_h player_ctx, int *is_muded);
@@ -0,0 +1,55 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_AVCLOCK_H__
+#define __LBMC_AVCLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "errors.h"
+
+/*
+ * Playback clock for PC players, the counterpart of the OMX clock. The audio player is the master and updates
+ * the clock with the PTS it is playing, the video player takes the stream start time from it. The clock is kept
+ * as the CLOCK_MONOTONIC time of PTS 0, readers do not take locks.
+ */
+
+typedef void* avclock_h;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ret_code_t avclock_init(avclock_h *h);
+void avclock_uninit(avclock_h h);
+
+/* Master side. pts_ms is playing at the moment */
+void avclock_update(avclock_h h, int64_t pts_ms);
+void avclock_pause(avclock_h h, int pause);
+/* Stop the clock till the next update, after a seek for example */
+void avclock_reset(avclock_h h);
+
+/* Time of PTS 0. Return L_FAILED if the master did not start the clock */
+ret_code_t avclock_get_base(avclock_h h, struct timespec *base);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,6 +23,8 @@
 #define AUDIO_BUFFERS       64
 #define AUDIO_BUFF_SIZE     (16 * 1024)
 #define AUDIO_BUFF_ALIGN    16
+/* Default PCM ring size, same memory as buffers */
+#define AUDIO_RING_SIZE     (AUDIO_BUFFERS * AUDIO_BUFF_SIZE)
 /* Default video buffer settings */
 #define VIDEO_BUFFERS       20
 
@@ -55,18 +57,40 @@ typedef struct {
     size_t buff_size;
     int nb_samples;
     int max_nb_samples;
+    /* Decoder frame reference in the passthrough mode. data points to its planes instead of own_data */
+    AVFrame *frame;
+    uint8_t **own_data;
 } audio_part_t;
 
 typedef struct {
 #ifdef CONFIG_VIDEO_HW_DECODE
     uint8_t *data;
     int buff_size;  /* Allocation size */
+    /* Demuxer packet reference in the passthrough mode. data points to its payload */
+    AVPacket *pkt;
 #else
     uint8_t *buffer[4];
     int linesize[4];
+    /* Decoder frame reference in the passthrough mode. buffer/linesize point to its planes */
+    AVFrame *frame;
+    /* Picture size. Differs from the stream one when frames are scaled to the player viewport */
+    int width;
+    int height;
 #endif
 } video_part_t;
 
+typedef struct {
+    int show_info;
+    /* Video decoder threads. 0 - detect automatically */
+    int threads;
+    /* FF_THREAD_FRAME and/or FF_THREAD_SLICE */
+    int thread_type;
+    /* Threads converting a frame to the player format. 0 - detect automatically */
+    int scale_workers;
+    /* Copy compressed packets to media buffers even if a player can take them by reference */
+    int packet_copy;
+} decode_params_t;
+
 typedef struct {
     queue_node_t node;
     media_buffer_type_t type;
@@ -80,18 +104,31 @@ typedef struct {
     int64_t pts_ms; /* PTS in ms from a stream begin */
     int64_t dts_ms; /* DTS in ms from a stream begin */
     media_buffer_status_t status;
+    /* Seek generation the buffer was decoded in. Buffers decoded before a seek are not handed to players */
+    uint32_t gen;
     void *app_data;
 } media_buffer_t;
 
-ret_code_t decode_init(demux_ctx_h *h, char *src_file, int show_info);
+ret_code_t decode_init(demux_ctx_h *h, char *src_file, decode_params_t *params);
 void decode_uninit(demux_ctx_h h);
 void decode_start_read(demux_ctx_h h);
 
 /* Access to buffers by player */
 media_buffer_t *decode_get_free_audio_buffer(demux_ctx_h h);
 media_buffer_t *decode_get_next_audio_buffer(demux_ctx_h h, ret_code_t *rc);
+/* Next decoded buffer if there is one, does not wait */
+media_buffer_t *decode_try_next_audio_buffer(demux_ctx_h h);
 void decode_release_audio_buffer(demux_ctx_h h, media_buffer_t *buff);
 ret_code_t decode_setup_audio_buffers(demux_ctx_h h, int amount, int align, int len);
+/*
+ * Access to the PCM ring by player, instead of buffers. Get returns the size of contiguous decoded data, the data
+ * stays in the ring till released. Any part of it may be released.
+ */
+ret_code_t decode_setup_audio_ring(demux_ctx_h h, int size);
+int decode_get_audio_data(demux_ctx_h h, uint8_t **data, int64_t *pts_ms, ret_code_t *rc);
+/* Does not wait */
+int decode_try_audio_data(demux_ctx_h h, uint8_t **data, int64_t *pts_ms);
+void decode_release_audio_data(demux_ctx_h h, int size);
 void release_all_buffers(demux_ctx_h h);
 void decode_set_requested_buffers_param(demux_ctx_h h, media_buffer_type_t type, int amount, int size, int align);
 
@@ -102,14 +139,47 @@ ret_code_t decode_next_audio_stream(demux_ctx_h h);
 #ifdef CONFIG_VIDEO
 media_buffer_t *decode_get_free_video_buffer(demux_ctx_h h);
 media_buffer_t *decode_get_next_video_buffer(demux_ctx_h h, ret_code_t *rc);
+/* Next decoded buffer if there is one, does not wait */
+media_buffer_t *decode_try_next_video_buffer(demux_ctx_h h);
+/* Statistic of the player. dropped - the buffer was released without drawing */
+void decode_count_video_frame(demux_ctx_h h, int dropped);
+/* Difference of the time a frame was shown and its PTS in us. The deviation is reported as judder */
+void decode_report_video_present(demux_ctx_h h, int error_us);
 void decode_release_video_buffer(demux_ctx_h h, media_buffer_t *buff);
 int devode_get_video_size(demux_ctx_h hd, int *w, int *h);
 ret_code_t decode_get_pixel_format(demux_ctx_h h, enum AVPixelFormat *pix_fmt);
+ret_code_t decode_get_color_info(demux_ctx_h h, enum AVColorSpace *space, enum AVColorRange *range);
 ret_code_t decode_get_codec_id(demux_ctx_h h, enum AVCodecID *codec_id);
 ret_code_t decode_get_frame_rate(demux_ctx_h h, int *rate, int *scale);  
 uint8_t *decode_get_codec_extra_data(demux_ctx_h h, int *size);
+/*
+ * Select pixel format of video buffers. formats is a list supported by a player ordered by preference and
+ * terminated by AV_PIX_FMT_NONE. If the decoder output is in the list frames are passed without a copy,
+ * otherwise they are converted to the first usable format. Has to be called before decode_setup_video_buffers.
+ */
+ret_code_t decode_negotiate_video_format(demux_ctx_h h, const enum AVPixelFormat *formats,
+    enum AVPixelFormat *pix_fmt);
 ret_code_t decode_setup_video_buffers(demux_ctx_h h, int amount, int align, int len);
+/* Viewport size of the player. Converted frames are scaled down to it. 0 - use the stream size */
+ret_code_t decode_set_video_output_size(demux_ctx_h h, int width, int height);
 ret_code_t decode_get_video_buffs_info(demux_ctx_h h, int *size, int *cont, int *align);
+/* Delay in ms added by the decoder (frame threading and reordering) */
+int decode_get_video_latency(demux_ctx_h h);
+#ifndef CONFIG_VIDEO_HW_DECODE
+/*
+ * Lateness of a frame at the presentation time in ms, negative if it came in advance. Drives the decoder
+ * degradation ladder: no loop filter, no IDCT of non-reference frames, no non-reference frames, key frames only.
+ */
+void decode_report_video_lateness(demux_ctx_h h, int late_ms);
+/* Current step of the degradation ladder, 0 - full decoding */
+int decode_get_skip_level(demux_ctx_h h);
+#else
+/*
+ * Pass compressed packets to the player by reference instead of copying them. Buffers hold the whole packet
+ * and keep it until released. Has to be called before decode_setup_video_buffers.
+ */
+ret_code_t decode_set_packet_passthrough(demux_ctx_h h, int enable);
+#endif
 #endif
 
 /* Output audio format. Used for a player configuration */
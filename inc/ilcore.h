@@ -60,7 +60,8 @@ typedef void* ilcore_comp_h;
 typedef void* ilcore_tunnel_h;
 
 typedef struct omx_event {
-    list_node_t node;
+    /* Indexed by eEvent and by eEvent with the data */
+    list_hnode_t node;
     OMX_EVENTTYPE eEvent;
     OMX_U32 nData1;
     OMX_U32 nData2;
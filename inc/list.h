@@ -30,9 +30,31 @@ typedef struct list_node_s {
     struct list_node_s *next;
 } list_node_t;
 
+#define LIST_MAX_INDEXES 2
+
+/* Place of a node in a bucket of one index */
+typedef struct list_hlink_s {
+    struct list_hnode_s *prev;
+    struct list_hnode_s *next;
+    unsigned int key;
+} list_hlink_t;
+
+/* Node of an indexed list. Keys of all indexes have to be set before the node is added */
+typedef struct list_hnode_s {
+    list_node_t node;
+    list_hlink_t link[LIST_MAX_INDEXES];
+    long long seq;
+} list_hnode_t;
+
 typedef int (*find_func)(list_node_t *node, void *user_data);
 
 int slist_init(list_h *h);
+/*
+ * List of list_hnode_t with indexes by key. Nodes may be inserted only to the head or to the tail.
+ * indexes - amount of keys of a node, up to LIST_MAX_INDEXES
+ * buckets - size of an index, rounded up to a power of 2
+ */
+int slist_init_indexed(list_h *h, int indexes, int buckets);
 void slist_uninit(list_h h);
 
 /* Thread safe functions */
@@ -42,6 +64,12 @@ int slist_add_tail(list_h h, list_node_t *node);
 list_node_t *slist_get_remove_head(list_h h);
 list_node_t *slist_get_remove_tail(list_h h);
 list_node_t *slist_find_remove(list_h h, find_func func, void *user_data);
+/*
+ * Indexed lists only. Remove the first node in the list order which has one of the keys in the index and is
+ * accepted by func. Only nodes with the same key hash are visited. func may be NULL.
+ */
+list_node_t *slist_find_remove_key(list_h h, int index, const unsigned int *keys, int count, find_func func,
+    void *user_data);
 
 int slist_get_count(list_h h);
 
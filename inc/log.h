@@ -28,33 +28,41 @@ typedef enum {
     LOG_LVL_FATAL
 } log_dbg_lvl_t;
 
+/*
+ * Messages below LOG_MIN_LEVEL are removed at compile time. Arguments are still checked by the compiler.
+ * Set by CONFIG_LOG_MIN_LEVEL. By default release builds drop messages below the warning level, as the run time
+ * filter does.
+ */
+#ifndef LOG_MIN_LEVEL
+#if defined(CONFIG_LOG_MIN_LEVEL)
+#define LOG_MIN_LEVEL CONFIG_LOG_MIN_LEVEL
+#elif defined(LBMC_DEBUG)
+#define LOG_MIN_LEVEL LOG_LVL_VERB
+#else
+#define LOG_MIN_LEVEL LOG_LVL_WARN
+#endif
+#endif
+
+/*
+ * Messages are formatted by the calling thread into its own ring and written by a background thread.
+ * A message is dropped rather than blocking the caller when the ring is full.
+ */
 void logs_init(char *file);
+/* Writes all pending messages. Other threads have to be finished */
 void logs_uninit(void);
 void lbmc_log(const char *file, int line, log_dbg_lvl_t lvl, char *fmt, ...);
 
-#define DBG_V(fmt,...) \
-    do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_VERB, fmt, ##__VA_ARGS__); \
-    } while(0)
-#define DBG_I(fmt,...) \
+#define LOG_MSG(lvl,fmt,...) \
     do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_INFO, fmt, ##__VA_ARGS__); \
-    } while(0)
-#define DBG_W(fmt,...) \
-    do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_WARN, fmt, ##__VA_ARGS__); \
-    } while(0)
-#define DBG_E(fmt,...) \
-    do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_ERROR, fmt, ##__VA_ARGS__); \
-    } while(0)
-#define DBG_A(fmt,...) \
-    do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_ALERT, fmt, ##__VA_ARGS__); \
-    } while(0)
-#define DBG_F(fmt,...) \
-    do { \
-    lbmc_log(__FILE__, __LINE__, LOG_LVL_FATAL, fmt, ##__VA_ARGS__); \
+    if ((lvl) >= LOG_MIN_LEVEL) \
+        lbmc_log(__FILE__, __LINE__, lvl, fmt, ##__VA_ARGS__); \
     } while(0)
 
+#define DBG_V(fmt,...) LOG_MSG(LOG_LVL_VERB, fmt, ##__VA_ARGS__)
+#define DBG_I(fmt,...) LOG_MSG(LOG_LVL_INFO, fmt, ##__VA_ARGS__)
+#define DBG_W(fmt,...) LOG_MSG(LOG_LVL_WARN, fmt, ##__VA_ARGS__)
+#define DBG_E(fmt,...) LOG_MSG(LOG_LVL_ERROR, fmt, ##__VA_ARGS__)
+#define DBG_A(fmt,...) LOG_MSG(LOG_LVL_ALERT, fmt, ##__VA_ARGS__)
+#define DBG_F(fmt,...) LOG_MSG(LOG_LVL_FATAL, fmt, ##__VA_ARGS__)
+
 #endif
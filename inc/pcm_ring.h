@@ -0,0 +1,70 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_PCM_RING_H__
+#define __LBMC_PCM_RING_H__
+
+#include <stdint.h>
+
+#include "errors.h"
+
+/*
+ * Contiguous ring of packed PCM samples between one producer (decoder) and one consumer (audio player). The
+ * producer appends samples with their PTS, the consumer takes any amount of them. PTS is kept as markers at
+ * discontinuities only and interpolated by the sample rate between them.
+ */
+
+/* Same value as AV_NOPTS_VALUE */
+#define PCM_RING_NOPTS  INT64_MIN
+
+typedef void* pcm_ring_h;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* size - in bytes, rounded down to whole frames. frame_size - bytes of one sample of all channels */
+ret_code_t pcm_ring_init(pcm_ring_h *h, int size, int frame_size, int rate);
+void pcm_ring_uninit(pcm_ring_h h);
+
+/*
+ * Producer side. Free contiguous space, waits up to timeout_ms while the ring is full. Return its size in bytes,
+ * 0 on timeout. Written bytes are appended by commit, pts_ms is the PTS of the first written sample or
+ * PCM_RING_NOPTS if the data continues the previous one.
+ */
+int pcm_ring_reserve(pcm_ring_h h, uint8_t **data, int timeout_ms);
+void pcm_ring_commit(pcm_ring_h h, int size, int64_t pts_ms);
+
+/*
+ * Consumer side. Filled contiguous data up to the next PTS discontinuity, waits up to timeout_ms while the ring
+ * is empty. Return its size in bytes, 0 on timeout. pts_ms gets the PTS of the first sample. Data stays in the
+ * ring until consumed.
+ */
+int pcm_ring_peek(pcm_ring_h h, uint8_t **data, int64_t *pts_ms, int timeout_ms);
+void pcm_ring_consume(pcm_ring_h h, int size);
+
+/* Drop the data, after a seek for example. Commit and consume of regions taken before are ignored */
+void pcm_ring_flush(pcm_ring_h h);
+/* Filled bytes and the ring size */
+void pcm_ring_get_fill(pcm_ring_h h, int *filled, int *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,8 +40,13 @@ extern "C" {
 queue_err_t queue_init(queue_h *h);
 void queue_uninit(queue_h h);
 queue_err_t queue_push(queue_h h, queue_node_t *node);
+/* Append a NULL terminated chain of nodes under a single lock */
+queue_err_t queue_push_batch(queue_h h, queue_node_t *first);
 queue_node_t *queue_pop(queue_h h);
+/* timeout in ms or QUEUE_INFINITE_WAIT. Measured by the monotonic clock */
 queue_node_t *queue_pop_timed(queue_h h, int timeout);
+/* Detach up to max nodes (all if max <= 0) as a NULL terminated chain. count - amount of detached nodes */
+queue_node_t *queue_pop_batch(queue_h h, int max, int *count);
 int queue_count(queue_h h);
 
 #ifdef __cplusplus
@@ -0,0 +1,56 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_RING_QUEUE_H__
+#define __LBMC_RING_QUEUE_H__
+
+#include "queue.h"
+
+/*
+ * Bounded queue of pointers for hand-off of media buffers between the decoder and a player. It is a single producer,
+ * single consumer ring: push and pop only publish their own position with a release store and take no locks. An end
+ * used by several threads (buffers released from player callbacks and from a seek, for example) has to be opened
+ * shared, then its threads are serialized by a mutex of that end. Threads sleep on a futex only when the queue is
+ * empty or full.
+ */
+
+/* ring_queue_init() flags */
+#define RING_QUEUE_SHARED_PUSH  0x1
+#define RING_QUEUE_SHARED_POP   0x2
+
+typedef void* ring_queue_h;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* size - capacity, rounded up to a power of 2. flags - RING_QUEUE_SHARED_* for ends used by several threads */
+queue_err_t ring_queue_init(ring_queue_h *h, int size, int flags);
+void ring_queue_uninit(ring_queue_h h);
+/* Waits while the queue is full */
+queue_err_t ring_queue_push(ring_queue_h h, void *item);
+void *ring_queue_pop(ring_queue_h h);
+/* timeout in ms or QUEUE_INFINITE_WAIT */
+void *ring_queue_pop_timed(ring_queue_h h, int timeout);
+int ring_queue_count(ring_queue_h h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_SAMPLE_PACK_H__
+#define __LBMC_SAMPLE_PACK_H__
+
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+#include "errors.h"
+
+/*
+ * Planar stereo to packed stereo conversion without resampling. Float to S16 conversion rounds half away from
+ * zero, swresample rounds half to even, so results may differ by one LSB on exact ties. SIMD variants give the
+ * same result as the C one.
+ */
+
+typedef void (*sample_pack_func_t)(uint8_t *const src[], uint8_t *dst, int nb_samples);
+
+typedef enum {
+    SAMPLE_PACK_ISA_AUTO = 0,
+    SAMPLE_PACK_ISA_C,
+    SAMPLE_PACK_ISA_SSE2,
+    SAMPLE_PACK_ISA_NEON
+} sample_pack_isa_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return the best converter for the CPU or NULL if the formats are not supported */
+sample_pack_func_t sample_pack_get_func(enum AVSampleFormat src_fmt, enum AVSampleFormat dst_fmt);
+/*
+ * Force the instruction set of all converters, for benchmarks and tests. SAMPLE_PACK_ISA_AUTO - the best one.
+ * L_FAILED if it is not supported by the build or the CPU.
+ */
+ret_code_t sample_pack_set_isa(sample_pack_isa_t isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_TRACE_H__
+#define __LBMC_TRACE_H__
+
+#include <stdint.h>
+
+#include "errors.h"
+
+/*
+ * Pipeline tracing. Spans are recorded to per-thread rings, the oldest ones are overwritten. At exit all rings are
+ * written to a Chrome trace-event JSON file, viewable by chrome://tracing or Perfetto. A span costs a single check
+ * while tracing is disabled.
+ */
+
+#define TRACE_NOPTS INT64_MIN
+
+typedef struct {
+    const char *name;
+    int64_t start_us;
+    /* In ms, TRACE_NOPTS if unknown. May be updated before the span ends */
+    int64_t pts;
+} trace_span_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enable tracing. The file is written by trace_uninit() */
+ret_code_t trace_init(const char *file);
+void trace_uninit(void);
+
+/* name has to be a string literal */
+void trace_begin(trace_span_t *span, const char *name, int64_t pts);
+void trace_end(trace_span_t *span);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -29,6 +29,10 @@
 #include "decode.h"
 #include "msleep.h"
 #include "control.h"
+#ifndef CONFIG_RASPBERRY_PI
+#include "vsync.h"
+#include "avclock.h"
+#endif
 
 /*
  * Video player interface.
@@ -50,6 +54,13 @@ typedef struct {
 #ifndef CONFIG_RASPBERRY_PI
     int first_pkt;
     msleep_h sched;
+    /* Display period of a frame. A frame is dropped when it is later than that */
+    int frame_ms;
+    struct timespec last_shown;
+    /* Set by players presenting with a swap interval */
+    vsync_h vsync;
+    /* Playback clock of the audio player. base_time follows it while it runs */
+    avclock_h clock;
 #endif
 
     struct timespec base_time;
@@ -60,6 +71,8 @@ typedef struct {
 
     demux_ctx_h demux_ctx;
     control_ctx_h ctrl_ctx;
+    /* Pixel formats the player can display, best first. AV_PIX_FMT_NONE terminated */
+    const enum AVPixelFormat *pix_fmts;
 
     ret_code_t (*init)(video_player_h ctx);
     void (*uninit)(video_player_h ctx);
@@ -67,7 +80,6 @@ typedef struct {
     void (*idle)(video_player_h ctx);
     int (*pause)(video_player_h ctx);
     ret_code_t (*seek)(video_player_h h, seek_direction_t dir, int32_t seek);
-    ret_code_t (*schedule)(video_player_h h, media_buffer_t *buf);
 } video_player_common_ctx_t;
 
 void *player_main_routine(void *args);
@@ -0,0 +1,59 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_VIDEO_SCALE_H__
+#define __LBMC_VIDEO_SCALE_H__
+
+#include <stdint.h>
+#include <libavutil/pixfmt.h>
+
+#include "errors.h"
+
+/*
+ * Frame conversion split to horizontal bands. Every band has own scale context and is processed by a worker
+ * thread. The caller thread converts the first band and waits for the rest. Frames scaled vertically are
+ * converted as a single band.
+ */
+
+typedef void* video_scale_h;
+
+typedef struct {
+    int width;
+    int height;
+    enum AVPixelFormat pix_fmt;
+} video_scale_fmt_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* workers - amount of bands, 0 - by number of CPUs */
+ret_code_t video_scale_init(video_scale_h *h, video_scale_fmt_t *src, video_scale_fmt_t *dst, int workers);
+void video_scale_uninit(video_scale_h h);
+/* Change the conversion. Worker threads are kept */
+ret_code_t video_scale_set_size(video_scale_h h, video_scale_fmt_t *src, video_scale_fmt_t *dst);
+ret_code_t video_scale_frame(video_scale_h h, uint8_t *const src[], const int src_stride[], uint8_t *const dst[],
+    const int dst_stride[]);
+/* Conversion time of the last frame and the average one, in microseconds */
+void video_scale_get_time(video_scale_h h, int *last_us, int *avg_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_VSYNC_H__
+#define __LBMC_VSYNC_H__
+
+#include <stdint.h>
+
+#include "errors.h"
+
+/*
+ * Vertical blank tracking for players presenting with a swap interval. The refresh period and phase are
+ * estimated from the time swaps return, frames are assigned to vertical blanks with a cadence following
+ * the frame rate (2:3 for 23.976 fps on 60 Hz), so small timing noise does not move a frame to another blank.
+ * All times are CLOCK_MONOTONIC in microseconds.
+ */
+
+typedef void* vsync_h;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* refresh_hz - display refresh rate if known, 0 - estimate it */
+ret_code_t vsync_init(vsync_h *h, int refresh_hz);
+void vsync_uninit(vsync_h h);
+/* Time a buffer swap waiting for the vertical blank returned */
+void vsync_swap_done(vsync_h h, int64_t swap_us);
+/*
+ * Vertical blank the frame with the presentation time pts_us has to be shown at. period_us is the refresh period.
+ * Return L_FAILED while the period is not known.
+ */
+ret_code_t vsync_get_target(vsync_h h, int64_t pts_us, int64_t *target_us, int *period_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __LBMC_YUV2RGB_H__
+#define __LBMC_YUV2RGB_H__
+
+#include <stdint.h>
+#include <libavutil/pixfmt.h>
+
+#include "errors.h"
+
+/*
+ * YUV420P and NV12 to RGBA conversion. BT.601 limited range, same as the default of swscale.
+ * SIMD variants give the same result as the C one.
+ */
+
+typedef void (*yuv2rgb_func_t)(uint8_t *const src[], const int src_stride[], uint8_t *dst, int dst_stride,
+    int width, int height);
+
+typedef enum {
+    YUV2RGB_ISA_AUTO = 0,
+    YUV2RGB_ISA_C,
+    YUV2RGB_ISA_SSE2,
+    YUV2RGB_ISA_AVX2,
+    YUV2RGB_ISA_NEON
+} yuv2rgb_isa_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return the best converter for the CPU or NULL if the formats are not supported */
+yuv2rgb_func_t yuv2rgb_get_func(enum AVPixelFormat src_fmt, enum AVPixelFormat dst_fmt);
+/*
+ * Force the instruction set of all converters, for benchmarks and tests. YUV2RGB_ISA_AUTO - the best one.
+ * L_FAILED if it is not supported by the build or the CPU.
+ */
+ret_code_t yuv2rgb_set_isa(yuv2rgb_isa_t isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,8 @@
 #include "omxclock.h"
 #include "guiapi.h"
 #include "hw_img_decode.h"
+#else
+#include "avclock.h"
 #endif
 
 #include "log.h"
@@ -37,11 +39,25 @@
 #include "audio_player.h"
 #include "video_player.h"
 #include "control.h"
+#include "trace.h"
 
 #define CMDOPT_SHOW_INFO    "--show-info"
 #define CMDOPT_HELP         "--help"
 #define CMDOPT_AUDIO_BUFFS  "--audio-buffs"
 #define CMDOPT_VIDEO_BUFFS  "--video-buffs"
+#define CMDOPT_DEC_THREADS  "--decode-threads"
+#define CMDOPT_THREAD_TYPE  "--decode-thread-type"
+#define CMDOPT_SCALE_THREADS "--scale-threads"
+#define CMDOPT_PACKET_COPY  "--packet-copy"
+#define CMDOPT_AUDIO_LATENCY "--audio-latency"
+#define CMDOPT_AUDIO_DEVICE "--audio-device"
+#define CMDOPT_TRACE        "--trace"
+
+/* Upper limit of thread amounts given on the command line */
+#define MAX_THREADS_PARAM   64
+/* Limits of the requested audio output latency */
+#define MIN_AUDIO_LATENCY_MS 1
+#define MAX_AUDIO_LATENCY_MS 5000
 
 typedef struct {
     int show_info;
@@ -51,6 +67,9 @@ typedef struct {
     int abuff_amount;
     int abuff_size;
     int abuff_align;
+    decode_params_t decode;
+    audio_player_params_t audio;
+    const char *trace_file;
 } cmdline_params_t;
 
 static struct termios orig_termios;
@@ -95,6 +114,13 @@ static void show_usage(void)
     printf("\t"CMDOPT_HELP"      - print this text\n");
     printf("\t"CMDOPT_AUDIO_BUFFS"=<amount>:<size>:[<alignment>] - audio buffers parameters\n");
     printf("\t"CMDOPT_VIDEO_BUFFS"=<amount>:<size>:[<alignment>] - video buffers parameters\n");
+    printf("\t"CMDOPT_DEC_THREADS"=<amount>|auto - video decoder threads\n");
+    printf("\t"CMDOPT_THREAD_TYPE"=frame|slice|both - video decoder threading method\n");
+    printf("\t"CMDOPT_SCALE_THREADS"=<amount>|auto - threads converting video frames\n");
+    printf("\t"CMDOPT_PACKET_COPY" - copy compressed video packets to buffers instead of passing references\n");
+    printf("\t"CMDOPT_AUDIO_LATENCY"=<ms>|auto - audio output latency\n");
+    printf("\t"CMDOPT_AUDIO_DEVICE"=<name> - ALSA output device, null discards the sound\n");
+    printf("\t"CMDOPT_TRACE"=<file.json> - record pipeline timings, written as Chrome trace events at exit\n");
 }
 
 static ret_code_t parse_buffers_param(char *str, int *amount, int *size, int *align)
@@ -155,6 +181,88 @@ Error:
     return L_FAILED;
 }
 
+static ret_code_t parse_threads_param(char *str, int *threads)
+{
+    char *start, *end;
+    long val;
+
+    start = strchr(str, '=');
+    if (!start)
+        goto Error;
+
+    start++;
+    if (!strcmp(start, "auto"))
+    {
+        *threads = 0;
+        return L_OK;
+    }
+    val = strtol(start, &end, 10);
+    if (end == start || *end != '\0' || val < 1 || val > MAX_THREADS_PARAM)
+        goto Error;
+    *threads = (int)val;
+
+    return L_OK;
+
+Error:
+    *threads = 0;
+    DBG_E("Incorrect format: %s\n", str);
+    return L_FAILED;
+}
+
+static ret_code_t parse_latency_param(char *str, int *latency_ms)
+{
+    char *start, *end;
+    long val;
+
+    start = strchr(str, '=');
+    if (!start)
+        goto Error;
+
+    start++;
+    if (!strcmp(start, "auto"))
+    {
+        *latency_ms = 0;
+        return L_OK;
+    }
+    val = strtol(start, &end, 10);
+    if (end == start || *end != '\0' || val < MIN_AUDIO_LATENCY_MS || val > MAX_AUDIO_LATENCY_MS)
+        goto Error;
+    *latency_ms = (int)val;
+
+    return L_OK;
+
+Error:
+    *latency_ms = 0;
+    DBG_E("Incorrect audio latency: %s. Expected %d..%d ms or auto\n", str, MIN_AUDIO_LATENCY_MS,
+        MAX_AUDIO_LATENCY_MS);
+    return L_FAILED;
+}
+
+static ret_code_t parse_thread_type_param(char *str, int *thread_type)
+{
+    char *start;
+
+    start = strchr(str, '=');
+    if (!start)
+        goto Error;
+
+    start++;
+    if (!strcmp(start, "frame"))
+        *thread_type = FF_THREAD_FRAME;
+    else if (!strcmp(start, "slice"))
+        *thread_type = FF_THREAD_SLICE;
+    else if (!strcmp(start, "both"))
+        *thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    else
+        goto Error;
+
+    return L_OK;
+
+Error:
+    DBG_E("Incorrect format: %s\n", str);
+    return L_FAILED;
+}
+
 static ret_code_t parse_command_line(int argc, char **argv, char **file, cmdline_params_t *params)
 {
     int i;
@@ -166,6 +274,13 @@ static ret_code_t parse_command_line(int argc, char **argv, char **file, cmdline
     params->abuff_amount = -1;
     params->abuff_size = -1;
     params->abuff_align = -1;
+    params->decode.threads = 0;
+    params->decode.thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    params->decode.scale_workers = 0;
+    params->decode.packet_copy = 0;
+    params->audio.latency_ms = 0;
+    params->audio.device = NULL;
+    params->trace_file = NULL;
 
     if (argc < 2 || !strcmp(argv[1], CMDOPT_HELP))
     {
@@ -208,6 +323,50 @@ static ret_code_t parse_command_line(int argc, char **argv, char **file, cmdline
                     params->vbuff_align);
             }
         }
+        else if (!strncmp(argv[i], CMDOPT_DEC_THREADS, strlen(CMDOPT_DEC_THREADS)))
+        {
+            if (parse_threads_param(argv[i], &params->decode.threads) != L_OK)
+            {
+                show_usage();
+                return L_FAILED;
+            }
+        }
+        else if (!strncmp(argv[i], CMDOPT_THREAD_TYPE, strlen(CMDOPT_THREAD_TYPE)))
+        {
+            if (parse_thread_type_param(argv[i], &params->decode.thread_type) != L_OK)
+            {
+                show_usage();
+                return L_FAILED;
+            }
+        }
+        else if (!strncmp(argv[i], CMDOPT_SCALE_THREADS, strlen(CMDOPT_SCALE_THREADS)))
+        {
+            if (parse_threads_param(argv[i], &params->decode.scale_workers) != L_OK)
+            {
+                show_usage();
+                return L_FAILED;
+            }
+        }
+        else if (!strcmp(argv[i], CMDOPT_PACKET_COPY))
+        {
+            params->decode.packet_copy = 1;
+        }
+        else if (!strncmp(argv[i], CMDOPT_AUDIO_LATENCY, strlen(CMDOPT_AUDIO_LATENCY)))
+        {
+            if (parse_latency_param(argv[i], &params->audio.latency_ms) != L_OK)
+            {
+                show_usage();
+                return L_FAILED;
+            }
+        }
+        else if (!strncmp(argv[i], CMDOPT_AUDIO_DEVICE "=", strlen(CMDOPT_AUDIO_DEVICE "=")))
+        {
+            params->audio.device = argv[i] + strlen(CMDOPT_AUDIO_DEVICE "=");
+        }
+        else if (!strncmp(argv[i], CMDOPT_TRACE "=", strlen(CMDOPT_TRACE "=")))
+        {
+            params->trace_file = argv[i] + strlen(CMDOPT_TRACE "=");
+        }
         else
         {
             printf("Unknown option: %s\n", argv[i]);
@@ -272,7 +431,14 @@ int main(int argc, char **argv)
 
     logs_init(NULL);
     if (parse_command_line(argc, argv, &src_filename, &params) != L_OK)
+    {
+        /* Flush messages about wrong options from the log rings */
+        trace_uninit();
+        logs_uninit();
         return -1;
+    }
+    if (params.trace_file)
+        trace_init(params.trace_file);
 
     hide_console_cursore();
     set_conio_terminal_mode();
@@ -288,7 +454,8 @@ int main(int argc, char **argv)
     }
 #endif
 
-    if (decode_init(&demux_ctx, src_filename, params.show_info))
+    params.decode.show_info = params.show_info;
+    if (decode_init(&demux_ctx, src_filename, &params.decode))
         goto end;
 
     decode_set_requested_buffers_param(demux_ctx, MB_AUDIO_TYPE, params.abuff_amount, params.abuff_size,
@@ -303,12 +470,16 @@ int main(int argc, char **argv)
         goto end;
 
     omx_clock_hdmi_clock_sync(clock);
+#else
+    /* Driven by the audio player, the video player follows it */
+    if (avclock_init(&clock))
+        goto end;
 #endif
     if (control_init(&ctrl) != L_OK)
         goto end;
 
     if (decode_is_audio(demux_ctx))
-        audio_player_start(&aplayer_ctx, demux_ctx, clock);
+        audio_player_start(&aplayer_ctx, demux_ctx, clock, &params.audio);
 #ifdef CONFIG_VIDEO  
     if (decode_is_video(demux_ctx))
     {
@@ -516,7 +687,10 @@ end:
     if (OMX_Deinit() != OMX_ErrorNone)
         DBG_E("OMX_deinit failed\n");
     bcm_host_deinit();
+#else
+    avclock_uninit(clock);
 #endif
+    trace_uninit();
     logs_uninit();
 
     return 0;
@@ -0,0 +1,165 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "list.h"
+
+/*
+ * Cost of list operations at 10, 1k and 100k nodes: tail append, find-and-remove by a callback scan and by the
+ * keyed index, head removal. A removed node goes back to the tail, so the list keeps its size. Run without
+ * arguments.
+ */
+
+#define BENCH_LOOKUPS   1000
+
+typedef struct {
+    list_hnode_t node;
+    unsigned int id;
+} bench_node_t;
+
+static const int sizes[] = { 10, 1000, 100000 };
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int find_id_cb(list_node_t *node, void *user_data)
+{
+    return ((bench_node_t *)node)->id == *(unsigned int *)user_data;
+}
+
+static double bench_add_tail(list_h list, bench_node_t *nodes, int count)
+{
+    int64_t start;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < count; i++)
+        slist_add_tail(list, &nodes[i].node.node);
+
+    return (double)(now_ns() - start) / count;
+}
+
+/* Average time of a lookup, -1 if a wrong node is found */
+static double bench_find_remove(list_h list, const unsigned int *ids, int lookups, int by_key)
+{
+    bench_node_t *node;
+    int64_t start;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < lookups; i++)
+    {
+        if (by_key)
+            node = (bench_node_t *)slist_find_remove_key(list, 0, &ids[i], 1, NULL, NULL);
+        else
+            node = (bench_node_t *)slist_find_remove(list, find_id_cb, (void *)&ids[i]);
+        if (!node || node->id != ids[i])
+            return -1;
+        slist_add_tail(list, &node->node.node);
+    }
+
+    return (double)(now_ns() - start) / lookups;
+}
+
+static double bench_remove_head(list_h list, int count)
+{
+    int64_t start;
+    int i;
+
+    start = now_ns();
+    for (i = 0; i < count; i++)
+        slist_get_remove_head(list);
+
+    return (double)(now_ns() - start) / count;
+}
+
+static int bench_size(int count)
+{
+    bench_node_t *nodes;
+    unsigned int *ids;
+    list_h plain = NULL, indexed = NULL;
+    double add, add_idx, scan, key, head;
+    int i, rc = -1;
+
+    nodes = (bench_node_t *)calloc(count, sizeof(bench_node_t));
+    ids = (unsigned int *)malloc(BENCH_LOOKUPS * sizeof(unsigned int));
+    if (!nodes || !ids || slist_init(&plain) || slist_init_indexed(&indexed, 1, count))
+    {
+        fprintf(stderr, "Initialization failed\n");
+        goto Exit;
+    }
+    for (i = 0; i < count; i++)
+    {
+        nodes[i].id = i;
+        nodes[i].node.link[0].key = i;
+    }
+    srand(count);
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        ids[i] = rand() % count;
+
+    add = bench_add_tail(plain, nodes, count);
+    scan = bench_find_remove(plain, ids, BENCH_LOOKUPS, 0);
+    head = bench_remove_head(plain, count);
+
+    /* The same nodes go to the indexed list */
+    add_idx = bench_add_tail(indexed, nodes, count);
+    key = bench_find_remove(indexed, ids, BENCH_LOOKUPS, 1);
+    bench_remove_head(indexed, count);
+
+    if (scan < 0 || key < 0)
+    {
+        fprintf(stderr, "Wrong node found in the list of %d nodes\n", count);
+        goto Exit;
+    }
+    printf("%6d %10.1f %10.1f %12.1f %12.1f %10.1f\n", count, add, add_idx, scan, key, head);
+    rc = 0;
+
+Exit:
+    slist_uninit(plain);
+    slist_uninit(indexed);
+    free(ids);
+    free(nodes);
+
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int i, rc = 0;
+
+    printf("%6s %10s %10s %12s %12s %10s  (ns per operation)\n", "nodes", "add_tail", "add_idx", "find_remove",
+        "remove_key", "rm_head");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+        if (bench_size(sizes[i]))
+            rc = 1;
+    }
+
+    return rc;
+}
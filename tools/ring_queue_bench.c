@@ -0,0 +1,210 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "queue.h"
+#include "ring_queue.h"
+
+/*
+ * Hand-off rate of ring_queue and queue_t between two threads. A pool of buffers goes around like media buffers
+ * between the decoder and a player: the producer takes a free buffer and pushes it to the filled queue, the
+ * consumer returns it to the free queue. Run without arguments.
+ */
+
+#define BENCH_HANDOFFS  200000
+#define RING_SIZE       256
+
+typedef struct {
+    queue_node_t node;
+    int seq;
+} bench_buf_t;
+
+typedef struct {
+    const char *name;
+    int (*init)(void **h);
+    void (*uninit)(void *h);
+    void (*push)(void *h, bench_buf_t *buf);
+    bench_buf_t *(*pop)(void *h);
+} queue_ops_t;
+
+typedef struct {
+    const queue_ops_t *ops;
+    void *free_q;
+    void *fill_q;
+    int handoffs;
+    int errors;
+} bench_ctx_t;
+
+static const int pools[] = { 1, 4, 64 };
+
+static int ring_init(void **h)
+{
+    return ring_queue_init(h, RING_SIZE, 0);
+}
+
+/* Both ends serialized like the free buffer queues of the demuxer */
+static int ring_shared_init(void **h)
+{
+    return ring_queue_init(h, RING_SIZE, RING_QUEUE_SHARED_PUSH | RING_QUEUE_SHARED_POP);
+}
+
+static void ring_push(void *h, bench_buf_t *buf)
+{
+    ring_queue_push(h, buf);
+}
+
+static bench_buf_t *ring_pop(void *h)
+{
+    return (bench_buf_t *)ring_queue_pop_timed(h, QUEUE_INFINITE_WAIT);
+}
+
+static int list_queue_init(void **h)
+{
+    return queue_init(h);
+}
+
+/* Buffers belong to the pool, queue_uninit would free nodes left in the queue */
+static void list_queue_uninit(void *h)
+{
+    while (queue_pop(h))
+        ;
+    queue_uninit(h);
+}
+
+static void list_queue_push(void *h, bench_buf_t *buf)
+{
+    queue_push(h, &buf->node);
+}
+
+static bench_buf_t *list_queue_pop(void *h)
+{
+    return (bench_buf_t *)queue_pop_timed(h, QUEUE_INFINITE_WAIT);
+}
+
+static const queue_ops_t queues[] = {
+    { "ring_queue", ring_init, ring_queue_uninit, ring_push, ring_pop },
+    { "ring_shared", ring_shared_init, ring_queue_uninit, ring_push, ring_pop },
+    { "queue", list_queue_init, list_queue_uninit, list_queue_push, list_queue_pop }
+};
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *consumer_routine(void *args)
+{
+    bench_ctx_t *ctx = (bench_ctx_t *)args;
+    bench_buf_t *buf;
+    int i;
+
+    for (i = 0; i < ctx->handoffs; i++)
+    {
+        buf = ctx->ops->pop(ctx->fill_q);
+        /* Single producer, so buffers come in order */
+        if (!buf || buf->seq != i)
+            ctx->errors++;
+        if (buf)
+            ctx->ops->push(ctx->free_q, buf);
+    }
+
+    return NULL;
+}
+
+static int bench_queue(const queue_ops_t *ops, int pool)
+{
+    bench_ctx_t ctx;
+    bench_buf_t *bufs, *buf;
+    pthread_t task;
+    int64_t start, elapsed;
+    int i, rc = -1;
+
+    memset(&ctx, 0, sizeof(bench_ctx_t));
+    ctx.ops = ops;
+    ctx.handoffs = BENCH_HANDOFFS;
+
+    bufs = (bench_buf_t *)calloc(pool, sizeof(bench_buf_t));
+    if (!bufs || ops->init(&ctx.free_q))
+        goto Exit;
+    if (ops->init(&ctx.fill_q))
+    {
+        ops->uninit(ctx.free_q);
+        goto Exit;
+    }
+    for (i = 0; i < pool; i++)
+        ops->push(ctx.free_q, &bufs[i]);
+
+    start = now_us();
+    if (pthread_create(&task, NULL, consumer_routine, &ctx))
+        goto Uninit;
+
+    for (i = 0; i < ctx.handoffs; i++)
+    {
+        buf = ops->pop(ctx.free_q);
+        if (!buf)
+        {
+            ctx.errors++;
+            continue;
+        }
+        buf->seq = i;
+        ops->push(ctx.fill_q, buf);
+    }
+    pthread_join(task, NULL);
+    elapsed = now_us() - start;
+
+    printf("%-12s %4d %12.0f %9.1f  %s\n", ops->name, pool, ctx.handoffs * 1000000.0 / elapsed,
+        elapsed * 1000.0 / ctx.handoffs, ctx.errors ? "ERRORS" : "ok");
+    rc = ctx.errors ? -1 : 0;
+
+Uninit:
+    ops->uninit(ctx.fill_q);
+    ops->uninit(ctx.free_q);
+Exit:
+    free(bufs);
+    if (rc && !ctx.errors)
+        fprintf(stderr, "Initialization of %s failed\n", ops->name);
+
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, rc = 0;
+
+    printf("%-12s %4s %12s %9s\n", "queue", "pool", "handoffs/s", "ns each");
+    for (i = 0; i < (int)(sizeof(pools) / sizeof(pools[0])); i++)
+    {
+        for (j = 0; j < (int)(sizeof(queues) / sizeof(queues[0])); j++)
+        {
+            if (bench_queue(&queues[j], pools[i]))
+                rc = 1;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,241 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#include <libswresample/swresample.h>
+
+#include "sample_pack.h"
+
+/*
+ * Checks SIMD variants of sample_pack against the C one and compares their speed with swr_convert doing the same
+ * conversion. Run without arguments.
+ */
+
+#define BENCH_MIN_US    200000
+#define BENCH_MIN_RUNS  100
+#define SAMPLE_RATE     48000
+
+typedef struct {
+    enum AVSampleFormat src_fmt;
+    enum AVSampleFormat dst_fmt;
+    const char *name;
+} pack_fmt_t;
+
+typedef struct {
+    const pack_fmt_t *fmt;
+    uint8_t *src[2];
+    uint8_t *dst;
+    uint8_t *ref;
+    int nb_samples;
+    int dst_size;
+} pack_buf_t;
+
+static const pack_fmt_t formats[] = {
+    { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT, "fltp-flt" },
+    { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16, "fltp-s16" },
+    { AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16, "s16p-s16" }
+};
+static const int sizes[] = { 1024, 4096 };
+static const char *isa_names[] = { "auto", "C", "SSE2", "NEON" };
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int buf_init(pack_buf_t *buf, const pack_fmt_t *fmt, int nb_samples)
+{
+    float *flt;
+    int16_t *s16;
+    int i, j;
+
+    memset(buf, 0, sizeof(pack_buf_t));
+    buf->fmt = fmt;
+    buf->nb_samples = nb_samples;
+    buf->dst_size = nb_samples * 2 * av_get_bytes_per_sample(fmt->dst_fmt);
+
+    srand(nb_samples);
+    for (i = 0; i < 2; i++)
+    {
+        buf->src[i] = (uint8_t *)malloc(nb_samples * av_get_bytes_per_sample(fmt->src_fmt));
+        if (!buf->src[i])
+            return -1;
+
+        flt = (float *)buf->src[i];
+        s16 = (int16_t *)buf->src[i];
+        for (j = 0; j < nb_samples; j++)
+        {
+            /* Floats go a bit out of range to hit clipping */
+            if (fmt->src_fmt == AV_SAMPLE_FMT_FLTP)
+                flt[j] = (rand() / (float)RAND_MAX - 0.5f) * 2.2f;
+            else
+                s16[j] = rand() & 0xffff;
+        }
+    }
+    buf->dst = (uint8_t *)malloc(buf->dst_size);
+    buf->ref = (uint8_t *)malloc(buf->dst_size);
+
+    return (buf->dst && buf->ref) ? 0 : -1;
+}
+
+static void buf_uninit(pack_buf_t *buf)
+{
+    free(buf->src[0]);
+    free(buf->src[1]);
+    free(buf->dst);
+    free(buf->ref);
+}
+
+/* Average time of a call, in nanoseconds */
+static double time_pack(sample_pack_func_t func, pack_buf_t *buf)
+{
+    int64_t start, elapsed;
+    int runs = 0;
+
+    start = now_us();
+    do
+    {
+        func(buf->src, buf->dst, buf->nb_samples);
+        runs++;
+        elapsed = now_us() - start;
+    } while (elapsed < BENCH_MIN_US || runs < BENCH_MIN_RUNS);
+
+    return elapsed * 1000.0 / runs;
+}
+
+static double time_swr(pack_buf_t *buf)
+{
+    struct SwrContext *swr;
+    int64_t start, elapsed;
+    int runs = 0;
+
+    swr = swr_alloc_set_opts(NULL, AV_CH_LAYOUT_STEREO, buf->fmt->dst_fmt, SAMPLE_RATE, AV_CH_LAYOUT_STEREO,
+        buf->fmt->src_fmt, SAMPLE_RATE, 0, NULL);
+    if (!swr || swr_init(swr) < 0)
+    {
+        swr_free(&swr);
+        return -1;
+    }
+
+    start = now_us();
+    do
+    {
+        swr_convert(swr, &buf->dst, buf->nb_samples, (const uint8_t **)buf->src, buf->nb_samples);
+        runs++;
+        elapsed = now_us() - start;
+    } while (elapsed < BENCH_MIN_US || runs < BENCH_MIN_RUNS);
+    swr_free(&swr);
+
+    return elapsed * 1000.0 / runs;
+}
+
+/* Largest difference of S16 samples, swresample rounds ties differently */
+static int max_diff(pack_buf_t *buf)
+{
+    const int16_t *a = (const int16_t *)buf->ref;
+    const int16_t *b = (const int16_t *)buf->dst;
+    int i, diff = 0;
+
+    for (i = 0; i < buf->nb_samples * 2; i++)
+        diff = FFMAX(diff, abs(a[i] - b[i]));
+
+    return diff;
+}
+
+static int bench_format(const pack_fmt_t *fmt, int nb_samples)
+{
+    sample_pack_func_t func;
+    pack_buf_t buf;
+    double c_ns = 0, ns;
+    int isa, diff, rc = 0;
+
+    if (buf_init(&buf, fmt, nb_samples))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        buf_uninit(&buf);
+        return -1;
+    }
+
+    for (isa = SAMPLE_PACK_ISA_C; isa <= SAMPLE_PACK_ISA_NEON; isa++)
+    {
+        if (sample_pack_set_isa((sample_pack_isa_t)isa))
+            continue;
+
+        func = sample_pack_get_func(fmt->src_fmt, fmt->dst_fmt);
+        memset(buf.dst, 0, buf.dst_size);
+        func(buf.src, buf.dst, nb_samples);
+        if (isa == SAMPLE_PACK_ISA_C)
+            memcpy(buf.ref, buf.dst, buf.dst_size);
+
+        ns = time_pack(func, &buf);
+        if (isa == SAMPLE_PACK_ISA_C)
+            c_ns = ns;
+        diff = memcmp(buf.ref, buf.dst, buf.dst_size);
+        if (diff)
+            rc = -1;
+        printf("%-8s %5d %-5s %10.0f ns  x%5.2f  %s\n", fmt->name, nb_samples, isa_names[isa], ns, c_ns / ns,
+            diff ? "MISMATCH" : "bit-exact");
+    }
+
+    ns = time_swr(&buf);
+    if (ns < 0)
+    {
+        printf("%-8s %5d %-5s not supported\n", fmt->name, nb_samples, "swr");
+    }
+    else if (fmt->dst_fmt == AV_SAMPLE_FMT_S16)
+    {
+        printf("%-8s %5d %-5s %10.0f ns  x%5.2f  max diff %d LSB\n", fmt->name, nb_samples, "swr", ns, c_ns / ns,
+            max_diff(&buf));
+    }
+    else
+    {
+        printf("%-8s %5d %-5s %10.0f ns  x%5.2f  %s\n", fmt->name, nb_samples, "swr", ns, c_ns / ns,
+            memcmp(buf.ref, buf.dst, buf.dst_size) ? "differs" : "bit-exact");
+    }
+
+    buf_uninit(&buf);
+
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, rc = 0;
+
+    printf("%-8s %5s %-5s %13s  %6s\n", "format", "size", "isa", "call", "vs C");
+    for (i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++)
+    {
+        for (j = 0; j < (int)(sizeof(sizes) / sizeof(sizes[0])); j++)
+        {
+            if (bench_format(&formats[i], sizes[j]))
+                rc = 1;
+        }
+    }
+    sample_pack_set_isa(SAMPLE_PACK_ISA_AUTO);
+
+    return rc;
+}
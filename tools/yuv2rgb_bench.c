@@ -0,0 +1,207 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libswscale/swscale.h>
+
+#include "yuv2rgb.h"
+
+/*
+ * Checks SIMD variants of yuv2rgb against the C one and compares their speed with sws_scale doing the same
+ * conversion. Run without arguments.
+ */
+
+#define BENCH_MIN_US    500000
+#define BENCH_MIN_RUNS  10
+
+typedef struct {
+    int width;
+    int height;
+} frame_size_t;
+
+typedef struct {
+    enum AVPixelFormat pix_fmt;
+    uint8_t *src[4];
+    int src_stride[4];
+    uint8_t *dst;
+    uint8_t *ref;
+    int dst_stride;
+    int width;
+    int height;
+} frame_t;
+
+static const frame_size_t sizes[] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+static const char *isa_names[] = { "auto", "C", "SSE2", "AVX2", "NEON" };
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int frame_init(frame_t *frame, enum AVPixelFormat pix_fmt, int width, int height)
+{
+    int i, planes, size;
+
+    memset(frame, 0, sizeof(frame_t));
+    frame->pix_fmt = pix_fmt;
+    frame->width = width;
+    frame->height = height;
+
+    planes = (pix_fmt == AV_PIX_FMT_NV12) ? 2 : 3;
+    for (i = 0; i < planes; i++)
+    {
+        frame->src_stride[i] = (i && pix_fmt != AV_PIX_FMT_NV12) ? (width / 2 + 63) & ~63 : (width + 63) & ~63;
+        size = frame->src_stride[i] * (i ? height / 2 : height);
+        frame->src[i] = (uint8_t *)malloc(size);
+        if (!frame->src[i])
+            return -1;
+        /* Full 0..255 range to hit clipping */
+        srand(i + 1);
+        while (size--)
+            frame->src[i][size] = rand() & 0xff;
+    }
+    frame->dst_stride = width * 4;
+    frame->dst = (uint8_t *)malloc(frame->dst_stride * height);
+    frame->ref = (uint8_t *)malloc(frame->dst_stride * height);
+
+    return (frame->dst && frame->ref) ? 0 : -1;
+}
+
+static void frame_uninit(frame_t *frame)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        free(frame->src[i]);
+    free(frame->dst);
+    free(frame->ref);
+}
+
+/* Average time of a frame, in microseconds */
+static double time_yuv2rgb(yuv2rgb_func_t func, frame_t *frame)
+{
+    int64_t start, elapsed;
+    int runs = 0;
+
+    start = now_us();
+    do
+    {
+        func(frame->src, frame->src_stride, frame->dst, frame->dst_stride, frame->width, frame->height);
+        runs++;
+        elapsed = now_us() - start;
+    } while (elapsed < BENCH_MIN_US || runs < BENCH_MIN_RUNS);
+
+    return (double)elapsed / runs;
+}
+
+static double time_sws(frame_t *frame)
+{
+    struct SwsContext *sws;
+    uint8_t *dst[4] = { frame->dst, NULL, NULL, NULL };
+    int dst_stride[4] = { frame->dst_stride, 0, 0, 0 };
+    int64_t start, elapsed;
+    int runs = 0;
+
+    /* The same context video_scale uses when yuv2rgb is not available */
+    sws = sws_getContext(frame->width, frame->height, frame->pix_fmt, frame->width, frame->height,
+        AV_PIX_FMT_RGBA, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws)
+        return -1;
+
+    start = now_us();
+    do
+    {
+        sws_scale(sws, (const uint8_t *const *)frame->src, frame->src_stride, 0, frame->height, dst, dst_stride);
+        runs++;
+        elapsed = now_us() - start;
+    } while (elapsed < BENCH_MIN_US || runs < BENCH_MIN_RUNS);
+    sws_freeContext(sws);
+
+    return (double)elapsed / runs;
+}
+
+static int bench_format(enum AVPixelFormat pix_fmt, const char *name, const frame_size_t *size)
+{
+    yuv2rgb_func_t func;
+    frame_t frame;
+    double c_us = 0, us;
+    int isa, diff, rc = 0;
+
+    /* Width is not multiple of a SIMD step, so row tails are checked too */
+    if (frame_init(&frame, pix_fmt, size->width + 6, size->height))
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        frame_uninit(&frame);
+        return -1;
+    }
+
+    for (isa = YUV2RGB_ISA_C; isa <= YUV2RGB_ISA_NEON; isa++)
+    {
+        if (yuv2rgb_set_isa((yuv2rgb_isa_t)isa))
+            continue;
+
+        func = yuv2rgb_get_func(pix_fmt, AV_PIX_FMT_RGBA);
+        memset(frame.dst, 0, frame.dst_stride * frame.height);
+        func(frame.src, frame.src_stride, frame.dst, frame.dst_stride, frame.width, frame.height);
+        if (isa == YUV2RGB_ISA_C)
+            memcpy(frame.ref, frame.dst, frame.dst_stride * frame.height);
+
+        us = time_yuv2rgb(func, &frame);
+        if (isa == YUV2RGB_ISA_C)
+            c_us = us;
+        diff = memcmp(frame.ref, frame.dst, frame.dst_stride * frame.height);
+        if (diff)
+            rc = -1;
+        printf("%-8s %4dx%-4d %-5s %9.1f us  x%5.2f  %s\n", name, size->width, size->height, isa_names[isa], us,
+            c_us / us, diff ? "MISMATCH" : "bit-exact");
+    }
+
+    us = time_sws(&frame);
+    if (us < 0)
+        printf("%-8s %4dx%-4d %-5s not supported\n", name, size->width, size->height, "sws");
+    else
+        printf("%-8s %4dx%-4d %-5s %9.1f us  x%5.2f\n", name, size->width, size->height, "sws", us, c_us / us);
+
+    frame_uninit(&frame);
+
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int i, rc = 0;
+
+    printf("%-8s %-9s %-5s %12s  %6s\n", "format", "size", "isa", "frame", "vs C");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+        if (bench_format(AV_PIX_FMT_YUV420P, "yuv420p", &sizes[i]))
+            rc = 1;
+        if (bench_format(AV_PIX_FMT_NV12, "nv12", &sizes[i]))
+            rc = 1;
+    }
+    yuv2rgb_set_isa(YUV2RGB_ISA_AUTO);
+
+    return rc;
+}
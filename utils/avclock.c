@@ -0,0 +1,149 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "avclock.h"
+
+/* Larger differences of the master time are applied at once, smaller ones are smoothed */
+#define AVCLOCK_JUMP_US     100000
+#define AVCLOCK_SMOOTH      16
+
+typedef struct {
+    /* Written by the master under the lock, read without it */
+    int64_t base_us;
+    int running;
+
+    pthread_mutex_t lock;
+    int paused;
+    int64_t pause_us;
+} avclock_t;
+
+static int64_t now_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+ret_code_t avclock_init(avclock_h *h)
+{
+    avclock_t *ctx;
+
+    ctx = (avclock_t *)malloc(sizeof(avclock_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(avclock_t));
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    *h = ctx;
+
+    return L_OK;
+}
+
+void avclock_uninit(avclock_h h)
+{
+    avclock_t *ctx = (avclock_t *)h;
+
+    if (!ctx)
+        return;
+
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+void avclock_update(avclock_h h, int64_t pts_ms)
+{
+    avclock_t *ctx = (avclock_t *)h;
+    int64_t base, diff;
+
+    if (!ctx)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->paused)
+    {
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    base = now_us() - pts_ms * 1000;
+    diff = base - __atomic_load_n(&ctx->base_us, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&ctx->running, __ATOMIC_RELAXED) && diff < AVCLOCK_JUMP_US && diff > -AVCLOCK_JUMP_US)
+        base -= diff - diff / AVCLOCK_SMOOTH;
+
+    __atomic_store_n(&ctx->base_us, base, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->running, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void avclock_pause(avclock_h h, int pause)
+{
+    avclock_t *ctx = (avclock_t *)h;
+
+    if (!ctx)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (pause && !ctx->paused)
+    {
+        ctx->pause_us = now_us();
+    }
+    else if (!pause && ctx->paused)
+    {
+        /* The stream did not move while paused */
+        __atomic_add_fetch(&ctx->base_us, now_us() - ctx->pause_us, __ATOMIC_RELEASE);
+    }
+    ctx->paused = pause;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void avclock_reset(avclock_h h)
+{
+    avclock_t *ctx = (avclock_t *)h;
+
+    if (!ctx)
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    __atomic_store_n(&ctx->running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+ret_code_t avclock_get_base(avclock_h h, struct timespec *base)
+{
+    avclock_t *ctx = (avclock_t *)h;
+    int64_t us;
+
+    if (!ctx || !__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE))
+        return L_FAILED;
+
+    us = __atomic_load_n(&ctx->base_us, __ATOMIC_ACQUIRE);
+    base->tv_sec = us / 1000000;
+    base->tv_nsec = (us % 1000000) * 1000;
+
+    return L_OK;
+}
@@ -21,6 +21,11 @@
 #include "log.h"
 
 #define IL_WAIT_TIMEOUT 100 /*ms*/
+/* Size of the component event indexes */
+#define IL_EVENT_BUCKETS 32
+/* Events are indexed by type for omx_core_comp_wait_event and by type with data for exact lookups */
+#define IL_INDEX_TYPE 0
+#define IL_INDEX_DATA 1
 
 typedef struct {
     OMX_HANDLETYPE handle;
@@ -127,6 +132,17 @@ static char *omx_event2str(OMX_EVENTTYPE event)
     return "Unknown";
 }
 
+static unsigned int event_key(OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2)
+{
+    unsigned int key;
+
+    key = (unsigned int)eEvent * 0x9E3779B1u;
+    key = (key ^ nData1) * 0x85EBCA77u;
+    key = (key ^ nData2) * 0xC2B2AE3Du;
+
+    return key ^ (key >> 16);
+}
+
 static int find_func_cb(list_node_t *node, void *user_data)
 {
     omx_event_t *s1 = (omx_event_t *)node;
@@ -138,17 +154,6 @@ static int find_func_cb(list_node_t *node, void *user_data)
     return 0;
 }
 
-static int search_event_cb(list_node_t *node, void *user_data)
-{
-	omx_event_t *event = (omx_event_t *)node;
-	int event_type = *(int *)user_data;
-
-	if (event->eEvent == OMX_EventError || event->eEvent == event_type)
-		return 1;
-
-	return 0;
-}
-
 OMX_ERRORTYPE il_event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent, 
     OMX_U32 nData1, OMX_U32 nData2, OMX_PTR pEventData)
 {
@@ -185,10 +190,11 @@ OMX_ERRORTYPE omx_core_comp_wait_event(ilcore_comp_h h, OMX_EVENTTYPE eventType,
     omx_event_t *event;
     OMX_ERRORTYPE rc = OMX_ErrorNone;
     ilcore_comp_ctx_t *ctx = (ilcore_comp_ctx_t *)h;
+    unsigned int keys[2] = { OMX_EventError, eventType };
 
     while (1)
     {
-        event = (omx_event_t *)slist_find_remove(ctx->event_list, search_event_cb, &eventType);
+        event = (omx_event_t *)slist_find_remove_key(ctx->event_list, IL_INDEX_TYPE, keys, 2, NULL, NULL);
         if (event)
         {
             if(event->eEvent == OMX_EventError && event->nData1 == (OMX_U32)OMX_ErrorSameState && event->nData2 == 1)
@@ -235,6 +241,7 @@ OMX_ERRORTYPE omx_core_comp_wait_command(ilcore_comp_h h, OMX_U32 command, OMX_U
     omx_event_t *event, cmp_event;
     OMX_ERRORTYPE rc = OMX_ErrorNone;
     ilcore_comp_ctx_t *ctx = (ilcore_comp_ctx_t *)h;
+    unsigned int key = event_key(OMX_EventCmdComplete, command, nData2);
 
     cmp_event.eEvent = OMX_EventCmdComplete;
     cmp_event.nData1 = command;
@@ -242,7 +249,8 @@ OMX_ERRORTYPE omx_core_comp_wait_command(ilcore_comp_h h, OMX_U32 command, OMX_U
 
     while(1)
     {
-        event = (omx_event_t *)slist_find_remove(ctx->event_list, find_func_cb, &cmp_event);
+        event = (omx_event_t *)slist_find_remove_key(ctx->event_list, IL_INDEX_DATA, &key, 1, find_func_cb,
+            &cmp_event);
         if (event)
         {
             if(event->eEvent == OMX_EventError && event->nData1 == (OMX_U32)OMX_ErrorSameState && event->nData2 == 1)
@@ -287,12 +295,14 @@ static void omx_core_comp_remove(ilcore_comp_ctx_t *comp, OMX_EVENTTYPE eEvent,
 {
     omx_event_t cmp_event;
     list_node_t *node;
+    unsigned int key = event_key(eEvent, nData1, nData2);
 
     cmp_event.eEvent = eEvent;
     cmp_event.nData1 = nData1;
     cmp_event.nData2 = nData2;
 
-    while ((node = slist_find_remove(comp->event_list, find_func_cb, &cmp_event)) != NULL)
+    while ((node = slist_find_remove_key(comp->event_list, IL_INDEX_DATA, &key, 1, find_func_cb,
+        &cmp_event)) != NULL)
         free(node);
 }
 
@@ -308,6 +318,8 @@ ret_code_t ilcore_add_comp_event(ilcore_comp_h h, OMX_EVENTTYPE eEvent, OMX_U32
     if (!event)
         return OMX_ErrorInsufficientResources;
 
+    event->node.link[IL_INDEX_TYPE].key = eEvent;
+    event->node.link[IL_INDEX_DATA].key = event_key(eEvent, nData1, nData2);
     event->eEvent = eEvent;
     event->nData1 = nData1;
     event->nData2 = nData2;
@@ -638,7 +650,12 @@ ret_code_t ilcore_init_comp(ilcore_comp_h *h, OMX_CALLBACKTYPE *cb, char *name)
     }
     memset(ctx, 0, sizeof(ilcore_comp_ctx_t));
 
-    slist_init(&ctx->event_list);
+    if (slist_init_indexed(&ctx->event_list, 2, IL_EVENT_BUCKETS))
+    {
+        DBG_E("Event list init failed\n");
+        free(ctx);
+        return L_FAILED;
+    }
     msleep_init(&ctx->event_sleep);
     
     ctx->name = strdup(name);
@@ -22,66 +22,161 @@
 #include <pthread.h>
 #include "list.h"
 
+typedef struct {
+    list_hnode_t *head;
+    list_hnode_t *tail;
+} list_bucket_t;
+
 typedef struct {
     list_node_t *head;
+    list_node_t *tail;
     pthread_mutex_t mutex;
     int count;
+
+    /* Optional indexes. Buckets of nodes with the same key hash, in the list order */
+    list_bucket_t *buckets[LIST_MAX_INDEXES];
+    int indexes;
+    unsigned int bucket_mask;
+    /* Order of nodes across buckets. Head insertions go down, tail ones go up */
+    long long head_seq;
+    long long tail_seq;
 } list_t;
 
 /* Private part */
 
+static list_bucket_t *bucket_priv(list_t *ctx, int index, unsigned int key)
+{
+    return &ctx->buckets[index][key & ctx->bucket_mask];
+}
+
+static void index_add_priv(list_t *ctx, list_node_t *node, int to_tail)
+{
+    list_hnode_t *hnode = (list_hnode_t *)node;
+    list_bucket_t *bucket;
+    list_hlink_t *link;
+    int i;
+
+    hnode->seq = to_tail ? ctx->tail_seq++ : --ctx->head_seq;
+    for (i = 0; i < ctx->indexes; i++)
+    {
+        bucket = bucket_priv(ctx, i, hnode->link[i].key);
+        link = &hnode->link[i];
+        if (to_tail)
+        {
+            link->prev = bucket->tail;
+            link->next = NULL;
+            if (bucket->tail)
+                bucket->tail->link[i].next = hnode;
+            else
+                bucket->head = hnode;
+            bucket->tail = hnode;
+        }
+        else
+        {
+            link->prev = NULL;
+            link->next = bucket->head;
+            if (bucket->head)
+                bucket->head->link[i].prev = hnode;
+            else
+                bucket->tail = hnode;
+            bucket->head = hnode;
+        }
+    }
+}
+
+static void index_remove_priv(list_t *ctx, list_node_t *node)
+{
+    list_hnode_t *hnode = (list_hnode_t *)node;
+    list_bucket_t *bucket;
+    list_hlink_t *link;
+    int i;
+
+    for (i = 0; i < ctx->indexes; i++)
+    {
+        bucket = bucket_priv(ctx, i, hnode->link[i].key);
+        link = &hnode->link[i];
+        if (link->prev)
+            link->prev->link[i].next = link->next;
+        else
+            bucket->head = link->next;
+        if (link->next)
+            link->next->link[i].prev = link->prev;
+        else
+            bucket->tail = link->prev;
+        link->prev = NULL;
+        link->next = NULL;
+    }
+}
+
 static void add_head_priv(list_t *ctx, list_node_t *node)
 {
     node->prev = NULL;
     node->next = ctx->head;
     if (ctx->head)
         ctx->head->prev = node;
+    else
+        ctx->tail = node;
     ctx->head = node;
     ctx->count++;
+
+    if (ctx->indexes)
+        index_add_priv(ctx, node, 0);
 }
 
 static list_node_t *find_tail_priv(list_t *ctx)
 {
-    list_node_t *tail = ctx->head;
-
-    tail = ctx->head;
-    while (tail->next)
-        tail = tail->next;
-
-    return tail;
+    return ctx->tail;
 }
 
 static void add_tail_priv(list_t *ctx, list_node_t *node)
 {
     list_node_t *tail = find_tail_priv(ctx);
 
+    if (!tail)
+    {
+        add_head_priv(ctx, node);
+        return;
+    }
     node->next = NULL;
     tail->next = node;
     node->prev = tail;
+    ctx->tail = node;
     ctx->count++;
+
+    if (ctx->indexes)
+        index_add_priv(ctx, node, 1);
+}
+
+static void remove_priv(list_t *ctx, list_node_t *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        ctx->head = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        ctx->tail = node->prev;
+    ctx->count--;
+
+    if (ctx->indexes)
+        index_remove_priv(ctx, node);
 }
 
 static list_node_t *remove_head_priv(list_t *ctx)
 {
-    list_node_t *ret_node;
+    list_node_t *ret_node = ctx->head;
 
-    ret_node = ctx->head;
-    ctx->head = ctx->head->next;
-    ctx->count--;
+    remove_priv(ctx, ret_node);
 
     return ret_node;
 }
 
 static list_node_t *remove_tail_priv(list_t *ctx)
 {
-    list_node_t *tail = find_tail_priv(ctx), *ret_node;
+    list_node_t *ret_node = find_tail_priv(ctx);
 
-    ret_node = tail;
-    if (tail == ctx->head)
-        ctx->head = NULL;
-    else
-        tail->prev->next = NULL;
-    ctx->count--;
+    remove_priv(ctx, ret_node);
 
     return ret_node;
 }
@@ -103,14 +198,47 @@ int slist_init(list_h *h)
     return 0;
 }
 
+int slist_init_indexed(list_h *h, int indexes, int buckets)
+{
+    list_t *ctx;
+    unsigned int size = 1;
+    int i;
+
+    if (indexes < 1 || indexes > LIST_MAX_INDEXES)
+        return -1;
+
+    if (slist_init(h))
+        return -1;
+
+    ctx = (list_t *)*h;
+    while (size < buckets)
+        size <<= 1;
+    for (i = 0; i < indexes; i++)
+    {
+        ctx->buckets[i] = (list_bucket_t *)calloc(size, sizeof(list_bucket_t));
+        if (!ctx->buckets[i])
+        {
+            slist_uninit(ctx);
+            return -1;
+        }
+    }
+    ctx->indexes = indexes;
+    ctx->bucket_mask = size - 1;
+
+    return 0;
+}
+
 void slist_uninit(list_h h)
 {
     list_t *ctx = (list_t *)h;
+    int i;
 
     if (!ctx)
         return;
 
     pthread_mutex_destroy(&ctx->mutex);
+    for (i = 0; i < LIST_MAX_INDEXES; i++)
+        free(ctx->buckets[i]);
     free(ctx);
 }
 
@@ -142,18 +270,45 @@ int slist_add_tail(list_h h, list_node_t *node)
         pthread_mutex_unlock(&ctx->mutex);
         return -1;
     }
-    if (!ctx->head)
-    {
-        add_head_priv(ctx, node);
-        goto Exit;
-    }
     add_tail_priv(ctx, node);
-Exit:
     pthread_mutex_unlock(&ctx->mutex);
 
     return 0;
 }
 
+list_node_t *slist_find_remove_key(list_h h, int index, const unsigned int *keys, int count, find_func func,
+    void *user_data)
+{
+    list_t *ctx = (list_t *)h;
+    list_hnode_t *hnode, *found = NULL;
+    int i;
+
+    if (index < 0 || index >= ctx->indexes)
+        return NULL;
+
+    pthread_mutex_lock(&ctx->mutex);
+    for (i = 0; i < count; i++)
+    {
+        /* Buckets are in the list order, so the first match is the oldest one of the key */
+        for (hnode = bucket_priv(ctx, index, keys[i])->head; hnode; hnode = hnode->link[index].next)
+        {
+            if (hnode->link[index].key == keys[i] && (!func || func(&hnode->node, user_data)))
+                break;
+        }
+        if (hnode && (!found || hnode->seq < found->seq))
+            found = hnode;
+    }
+    if (found)
+    {
+        remove_priv(ctx, &found->node);
+        found->node.prev = NULL;
+        found->node.next = NULL;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return (list_node_t *)found;
+}
+
 list_node_t *slist_get_remove_head(list_h h)
 {
     list_t *ctx = (list_t *)h;
@@ -212,20 +367,7 @@ list_node_t *slist_find_remove(list_h h, find_func func, void *user_data)
     if (!tmp)
         goto Exit;
 
-    if (tmp == ctx->head)
-    {
-        remove_head_priv(ctx);
-    }
-    else if (!tmp->next)
-    {
-        remove_tail_priv(ctx);
-    }
-    else
-    {
-        tmp->prev->next = tmp->next;
-        tmp->next->prev = tmp->prev;
-        ctx->count--;
-    }
+    remove_priv(ctx, tmp);
 
     tmp->prev = NULL;
     tmp->next = NULL;
@@ -269,13 +411,7 @@ int list_add_tail(list_h h, list_node_t *node)
     if (!ctx || !node)
         return -1;
 
-    if (!ctx->head)
-    {
-        add_head_priv(ctx, node);
-        goto Exit;
-    }
     add_tail_priv(ctx, node);
-Exit:
 
     return 0;
 }
@@ -287,6 +423,10 @@ int list_insert_after(list_h h, list_node_t *after, list_node_t *node)
     if (!ctx || !node)
         return -1;
 
+    /* Order of indexed nodes is kept for head and tail insertions only */
+    if (ctx->indexes)
+        return -1;
+
     if (!after || !after->next)
     {
         add_tail_priv(ctx, node);
@@ -309,6 +449,9 @@ int list_insert_before(list_h h, list_node_t *before, list_node_t *node)
     if (!ctx || !node)
         return -1;
 
+    if (ctx->indexes)
+        return -1;
+
     if (!before || !before->prev)
     {
         add_head_priv(ctx, node);
@@ -397,20 +540,7 @@ int list_remove(list_h h, list_node_t *node)
     if (!ctx || !node)
         return -1;
 
-    if (node == ctx->head)
-    {
-        remove_head_priv(ctx);
-    }
-    else if (!node->next)
-    {
-        remove_tail_priv(ctx);
-    }
-    else
-    {
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
-        ctx->count--;
-    }
+    remove_priv(ctx, node);
 
     node->prev = NULL;
     node->next = NULL;
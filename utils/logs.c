@@ -17,11 +17,22 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "log.h"
+#include "timeutils.h"
 
 #define LOG_BUFF_LEN    512
+/* Room for the level, file and line prefix */
+#define LOG_LINE_LEN    (LOG_BUFF_LEN + 128)
+/* Messages buffered per thread. A message is dropped when the ring of its thread is full */
+#define LOG_RING_SLOTS  128
+/* The writer thread wakes up at least this often */
+#define LOG_FLUSH_MS    100
 
 #ifdef LBMC_DEBUG
 static log_dbg_lvl_t current_log_level = LOG_LVL_INFO;
@@ -29,12 +40,205 @@ static log_dbg_lvl_t current_log_level = LOG_LVL_INFO;
 static log_dbg_lvl_t current_log_level = LOG_LVL_WARN;
 #endif
 
+typedef struct {
+    /* Global order of messages from different threads */
+    unsigned int seq;
+    int len;
+    char text[LOG_LINE_LEN];
+} log_slot_t;
+
+/*
+ * Single producer/single consumer ring. The owner thread advances the tail, the writer thread advances the head.
+ */
+typedef struct log_ring_s {
+    struct log_ring_s *next;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int dropped;
+    /* Owner thread exited. The ring is released by the writer when drained */
+    int dead;
+    log_slot_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
 static char *str_log_lvl[] = {"VERB", "INFO", "WARN", "ERROR", "ALERT", "FATAL"};
-static char log_buff[LOG_BUFF_LEN];
 static FILE *output = NULL;
 
+static log_ring_t *rings;
+/* Protects the list of rings. Taken by the logging threads only on the first message */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread log_ring_t *thread_ring;
+static unsigned int log_seq;
+
+static pthread_t writer;
+static int writer_run;
+static int writer_idle;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond;
+
+static int format_line(char *buff, const char *file, int line, log_dbg_lvl_t lvl, char *fmt, va_list ap)
+{
+    int len;
+
+    len = snprintf(buff, LOG_LINE_LEN, "[%5s][%s:%d] ", str_log_lvl[lvl], file, line);
+    if (len >= LOG_LINE_LEN)
+        len = LOG_LINE_LEN - 1;
+    /* Reserve a last byte for string terminator */
+    len += vsnprintf(buff + len, LOG_BUFF_LEN - 1 < LOG_LINE_LEN - len ? LOG_BUFF_LEN - 1 : LOG_LINE_LEN - len,
+        fmt, ap);
+
+    return len < LOG_LINE_LEN ? len : LOG_LINE_LEN - 1;
+}
+
+static void thread_exit_cb(void *data)
+{
+    log_ring_t *ring = (log_ring_t *)data;
+
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static log_ring_t *get_thread_ring(void)
+{
+    log_ring_t *ring = thread_ring;
+
+    if (ring)
+        return ring;
+
+    ring = (log_ring_t *)malloc(sizeof(log_ring_t));
+    if (!ring)
+        return NULL;
+    memset(ring, 0, sizeof(log_ring_t));
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+
+    return ring;
+}
+
+/*
+ * Write buffered messages of all threads in the order they were logged. Return amount of written messages.
+ * Logging threads only add rings to the head of the list and only the writer removes them, so rings of the
+ * snapshot taken under the lock stay valid. Files are written without the lock, a thread logging the first time
+ * does not wait for the I/O.
+ */
+static int write_pending(void)
+{
+    log_ring_t *ring, *first, *list, **link, *dead = NULL;
+    log_slot_t *slot;
+    unsigned int dropped;
+    int written = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    list = rings;
+    pthread_mutex_unlock(&rings_lock);
+
+    while (1)
+    {
+        first = NULL;
+        for (ring = list; ring; ring = ring->next)
+        {
+            if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+                continue;
+            if (!first || (int)(ring->slots[ring->head % LOG_RING_SLOTS].seq -
+                first->slots[first->head % LOG_RING_SLOTS].seq) < 0)
+            {
+                first = ring;
+            }
+        }
+        if (!first)
+            break;
+
+        slot = &first->slots[first->head % LOG_RING_SLOTS];
+        fwrite(slot->text, 1, slot->len, output);
+        __atomic_store_n(&first->head, first->head + 1, __ATOMIC_RELEASE);
+        written++;
+    }
+
+    for (ring = list; ring; ring = ring->next)
+    {
+        dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped)
+            fprintf(output, "[%5s][%s:%d] %u messages were dropped\n", str_log_lvl[LOG_LVL_WARN], __FILE__,
+                __LINE__, dropped);
+    }
+
+    /* Unlink drained rings of finished threads. Released after the lock */
+    pthread_mutex_lock(&rings_lock);
+    link = &rings;
+    while ((ring = *link) != NULL)
+    {
+        if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+            ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        {
+            *link = ring->next;
+            ring->next = dead;
+            dead = ring;
+            continue;
+        }
+        link = &ring->next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    while ((ring = dead) != NULL)
+    {
+        dead = ring->next;
+        free(ring);
+    }
+
+    if (written && output != stderr)
+        fflush(output);
+
+    return written;
+}
+
+static int has_pending(void)
+{
+    log_ring_t *ring;
+    int pending = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring && !pending; ring = ring->next)
+        pending = (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+    pthread_mutex_unlock(&rings_lock);
+
+    return pending;
+}
+
+static void *writer_routine(void *args)
+{
+    struct timespec wait_time;
+
+    while (__atomic_load_n(&writer_run, __ATOMIC_ACQUIRE))
+    {
+        if (write_pending())
+            continue;
+
+        pthread_mutex_lock(&writer_lock);
+        __atomic_store_n(&writer_idle, 1, __ATOMIC_SEQ_CST);
+        /* A message logged after the last pass may have missed the idle flag */
+        if (!has_pending() && __atomic_load_n(&writer_run, __ATOMIC_ACQUIRE))
+        {
+            clock_gettime(CLOCK_MONOTONIC, &wait_time);
+            util_time_add(&wait_time, LOG_FLUSH_MS);
+            pthread_cond_timedwait(&writer_cond, &writer_lock, &wait_time);
+        }
+        __atomic_store_n(&writer_idle, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&writer_lock);
+    }
+    write_pending();
+
+    return NULL;
+}
+
 void logs_init(char *file)
 {
+    pthread_condattr_t attr;
+
     if (!file)
     {
         output = stderr;
@@ -45,26 +249,92 @@ void logs_init(char *file)
         if (!output)
             output = stderr;
     }
+
+    if (pthread_key_create(&ring_key, thread_exit_cb))
+        return;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&writer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    __atomic_store_n(&writer_run, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, writer_routine, NULL))
+    {
+        /* Messages are written by the logging threads */
+        __atomic_store_n(&writer_run, 0, __ATOMIC_RELEASE);
+        pthread_cond_destroy(&writer_cond);
+        pthread_key_delete(ring_key);
+    }
 }
 
 void logs_uninit(void)
 {
+    log_ring_t *ring;
+
+    if (__atomic_load_n(&writer_run, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&writer_lock);
+        __atomic_store_n(&writer_run, 0, __ATOMIC_RELEASE);
+        pthread_cond_signal(&writer_cond);
+        pthread_mutex_unlock(&writer_lock);
+        pthread_join(writer, NULL);
+
+        /* Other threads are finished at this point */
+        while ((ring = rings) != NULL)
+        {
+            rings = ring->next;
+            free(ring);
+        }
+        thread_ring = NULL;
+        pthread_key_delete(ring_key);
+        pthread_cond_destroy(&writer_cond);
+    }
+
     if (output && output != stderr)
         fclose(output);
+    output = NULL;
 }
 
 void lbmc_log(const char *file, int line, log_dbg_lvl_t lvl, char *fmt, ...)
 {
     va_list ap;
+    log_ring_t *ring = NULL;
+    log_slot_t *slot;
+    unsigned int tail;
+    char buff[LOG_LINE_LEN];
 
     if (lvl < current_log_level)
         return;
 
+    if (__atomic_load_n(&writer_run, __ATOMIC_ACQUIRE))
+        ring = get_thread_ring();
+
+    if (!ring)
+    {
+        /* Before logs_init() or after logs_uninit() */
+        va_start(ap, fmt);
+        format_line(buff, file, line, lvl, fmt, ap);
+        va_end(ap);
+        fputs(buff, output ? output : stderr);
+        return;
+    }
+
+    tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS)
+    {
+        /* Never block the caller. The writer reports the loss */
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot = &ring->slots[tail % LOG_RING_SLOTS];
+
     va_start(ap, fmt);
-    /* Reserve a last byte for string terminator */
-    vsnprintf(log_buff, LOG_BUFF_LEN - 1, fmt, ap);
+    slot->len = format_line(slot->text, file, line, lvl, fmt, ap);
     va_end(ap);
-    fprintf(output, "[%5s][%s:%d] %s", str_log_lvl[lvl], file, line, log_buff);
-    if (output != stderr)
-        fflush(output);
+    slot->seq = __atomic_fetch_add(&log_seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&writer_idle, __ATOMIC_SEQ_CST))
+        pthread_cond_signal(&writer_cond);
 }
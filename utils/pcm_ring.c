@@ -0,0 +1,278 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "log.h"
+#include "pcm_ring.h"
+#include "timeutils.h"
+
+/* Not consumed PTS discontinuities. The oldest one is overwritten if there are more */
+#define PCM_RING_MARKERS    32
+/* PTS differs from the interpolated one more than this - a new marker */
+#define PCM_RING_JITTER_MS  20
+
+typedef struct {
+    /* Position in the stream of bytes */
+    uint64_t pos;
+    int64_t pts_ms;
+} marker_t;
+
+typedef struct {
+    uint8_t *data;
+    int size;
+    int frame_size;
+    int rate;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    /* Total written and read bytes. Offsets in the ring are these modulo size */
+    uint64_t write_pos;
+    uint64_t read_pos;
+
+    marker_t markers[PCM_RING_MARKERS];
+    int first_marker;
+    int markers_count;
+
+    /* Incremented by flush. Regions taken before are stale */
+    int epoch;
+    int reserve_epoch;
+    int peek_epoch;
+} pcm_ring_t;
+
+static marker_t *get_marker(pcm_ring_t *ring, int i)
+{
+    return &ring->markers[(ring->first_marker + i) % PCM_RING_MARKERS];
+}
+
+static int64_t pts_at(pcm_ring_t *ring, marker_t *marker, uint64_t pos)
+{
+    return marker->pts_ms + (int64_t)((pos - marker->pos) / ring->frame_size) * 1000 / ring->rate;
+}
+
+/* Wait for a condition variable up to timeout_ms. Return 0 on timeout */
+static int wait_cond(pcm_ring_t *ring, pthread_cond_t *cond, int timeout_ms)
+{
+    struct timespec wait_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &wait_time);
+    util_time_add(&wait_time, timeout_ms);
+
+    return pthread_cond_timedwait(cond, &ring->lock, &wait_time) != ETIMEDOUT;
+}
+
+ret_code_t pcm_ring_init(pcm_ring_h *h, int size, int frame_size, int rate)
+{
+    pcm_ring_t *ring;
+    pthread_condattr_t attr;
+
+    if (frame_size <= 0 || rate <= 0 || size < frame_size)
+    {
+        DBG_E("Incorrect ring parameters\n");
+        return L_FAILED;
+    }
+
+    ring = (pcm_ring_t *)malloc(sizeof(pcm_ring_t));
+    if (!ring)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ring, 0, sizeof(pcm_ring_t));
+
+    ring->frame_size = frame_size;
+    ring->rate = rate;
+    ring->size = size - size % frame_size;
+    ring->data = (uint8_t *)malloc(ring->size);
+    if (!ring->data)
+    {
+        DBG_E("Memory allocation failed\n");
+        free(ring);
+        return L_FAILED;
+    }
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring->not_empty, &attr);
+    pthread_cond_init(&ring->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+
+    *h = ring;
+
+    return L_OK;
+}
+
+void pcm_ring_uninit(pcm_ring_h h)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+
+    if (!ring)
+        return;
+
+    pthread_cond_destroy(&ring->not_empty);
+    pthread_cond_destroy(&ring->not_full);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->data);
+    free(ring);
+}
+
+int pcm_ring_reserve(pcm_ring_h h, uint8_t **data, int timeout_ms)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+    int offset, size = 0;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->write_pos - ring->read_pos == ring->size && timeout_ms)
+        wait_cond(ring, &ring->not_full, timeout_ms);
+
+    if (ring->write_pos - ring->read_pos < ring->size)
+    {
+        offset = ring->write_pos % ring->size;
+        size = ring->size - (int)(ring->write_pos - ring->read_pos);
+        if (size > ring->size - offset)
+            size = ring->size - offset;
+        *data = ring->data + offset;
+    }
+    ring->reserve_epoch = ring->epoch;
+    pthread_mutex_unlock(&ring->lock);
+
+    return size;
+}
+
+void pcm_ring_commit(pcm_ring_h h, int size, int64_t pts_ms)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+    marker_t *last;
+
+    if (size <= 0)
+        return;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->reserve_epoch != ring->epoch)
+    {
+        pthread_mutex_unlock(&ring->lock);
+        return;
+    }
+
+    if (pts_ms != PCM_RING_NOPTS)
+    {
+        last = ring->markers_count ? get_marker(ring, ring->markers_count - 1) : NULL;
+        if (!last || llabs(pts_at(ring, last, ring->write_pos) - pts_ms) > PCM_RING_JITTER_MS)
+        {
+            if (ring->markers_count == PCM_RING_MARKERS)
+            {
+                ring->first_marker = (ring->first_marker + 1) % PCM_RING_MARKERS;
+                ring->markers_count--;
+            }
+            last = get_marker(ring, ring->markers_count++);
+            last->pos = ring->write_pos;
+            last->pts_ms = pts_ms;
+        }
+    }
+    ring->write_pos += size;
+    pthread_cond_signal(&ring->not_empty);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+int pcm_ring_peek(pcm_ring_h h, uint8_t **data, int64_t *pts_ms, int timeout_ms)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+    marker_t *marker;
+    int offset, size = 0;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->write_pos == ring->read_pos && timeout_ms)
+        wait_cond(ring, &ring->not_empty, timeout_ms);
+
+    if (ring->write_pos != ring->read_pos)
+    {
+        /* Markers before the read position are not needed except the last one */
+        while (ring->markers_count > 1 && get_marker(ring, 1)->pos <= ring->read_pos)
+        {
+            ring->first_marker = (ring->first_marker + 1) % PCM_RING_MARKERS;
+            ring->markers_count--;
+        }
+
+        offset = ring->read_pos % ring->size;
+        size = (int)(ring->write_pos - ring->read_pos);
+        if (size > ring->size - offset)
+            size = ring->size - offset;
+
+        *pts_ms = PCM_RING_NOPTS;
+        if (ring->markers_count)
+        {
+            marker = get_marker(ring, 0);
+            if (marker->pos <= ring->read_pos)
+            {
+                *pts_ms = pts_at(ring, marker, ring->read_pos);
+                marker = (ring->markers_count > 1) ? get_marker(ring, 1) : NULL;
+            }
+            /* Stop before the next discontinuity */
+            if (marker && marker->pos - ring->read_pos < size)
+                size = (int)(marker->pos - ring->read_pos);
+        }
+        *data = ring->data + offset;
+    }
+    ring->peek_epoch = ring->epoch;
+    pthread_mutex_unlock(&ring->lock);
+
+    return size;
+}
+
+void pcm_ring_consume(pcm_ring_h h, int size)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->peek_epoch == ring->epoch && size > 0)
+    {
+        if (size > ring->write_pos - ring->read_pos)
+            size = (int)(ring->write_pos - ring->read_pos);
+        ring->read_pos += size;
+        pthread_cond_signal(&ring->not_full);
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void pcm_ring_flush(pcm_ring_h h)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+
+    pthread_mutex_lock(&ring->lock);
+    ring->read_pos = ring->write_pos;
+    ring->markers_count = 0;
+    ring->epoch++;
+    pthread_cond_signal(&ring->not_full);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void pcm_ring_get_fill(pcm_ring_h h, int *filled, int *size)
+{
+    pcm_ring_t *ring = (pcm_ring_t *)h;
+
+    pthread_mutex_lock(&ring->lock);
+    *filled = (int)(ring->write_pos - ring->read_pos);
+    *size = ring->size;
+    pthread_mutex_unlock(&ring->lock);
+}
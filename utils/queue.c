@@ -19,8 +19,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <errno.h>
 
 #include "queue.h"
@@ -30,8 +30,10 @@
 typedef struct {
     queue_node_t *first_node;
     queue_node_t *last_node;
+    int count;
     pthread_mutex_t mutex;
-    sem_t sem_count;
+    /* Signaled on push. Waits use CLOCK_MONOTONIC and are not affected by wall clock steps */
+    pthread_cond_t cond;
 } queue_t;
 
 
@@ -50,9 +52,59 @@ static void destroy_queue(queue_t *q)
     pthread_mutex_unlock(&q->mutex);
 }
 
+/* Append a chain of nodes. Called with the mutex locked */
+static void append_nodes(queue_t *q, queue_node_t *first, queue_node_t *last, int count)
+{
+    if (!q->first_node)
+        q->first_node = first;
+    else
+        q->last_node->next = first;
+    q->last_node = last;
+    q->count += count;
+
+    if (count == 1)
+        pthread_cond_signal(&q->cond);
+    else
+        pthread_cond_broadcast(&q->cond);
+}
+
+/* Detach up to max nodes from the head. Called with the mutex locked */
+static queue_node_t *detach_nodes(queue_t *q, int max, int *count)
+{
+    queue_node_t *first, *last;
+    int i;
+
+    first = q->first_node;
+    if (!first)
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    if (max <= 0 || max >= q->count)
+    {
+        *count = q->count;
+        q->first_node = q->last_node = NULL;
+        q->count = 0;
+
+        return first;
+    }
+
+    last = first;
+    for (i = 1; i < max; i++)
+        last = last->next;
+    q->first_node = last->next;
+    last->next = NULL;
+    q->count -= max;
+    *count = max;
+
+    return first;
+}
+
 queue_err_t queue_init(queue_h *h)
 {
     queue_t *queue;
+    pthread_condattr_t attr;
 
     queue = (queue_t *)malloc(sizeof(queue_t));
     if (!queue)
@@ -60,18 +112,25 @@ queue_err_t queue_init(queue_h *h)
 
     memset(queue, 0, sizeof(queue_t));
     if (pthread_mutex_init(&queue->mutex, NULL))
-        goto Error;
+    {
+        free(queue);
+        return QUE_FAILED;
+    }
 
-    if (sem_init(&queue->sem_count, 0, 0))
-        goto Error;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&queue->cond, &attr))
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&queue->mutex);
+        free(queue);
+        return QUE_FAILED;
+    }
+    pthread_condattr_destroy(&attr);
 
     *h = queue;
 
     return QUE_OK;
-
-Error:
-    queue_uninit(queue);
-    return QUE_FAILED;
 }
 
 void queue_uninit(queue_h h)
@@ -83,7 +142,7 @@ void queue_uninit(queue_h h)
     
     destroy_queue(queue);
 
-    sem_destroy(&queue->sem_count);
+    pthread_cond_destroy(&queue->cond);
     pthread_mutex_destroy(&queue->mutex);
     free(queue);
 }
@@ -95,17 +154,27 @@ queue_err_t queue_push(queue_h h, queue_node_t *node)
     node->next = NULL;
 
     pthread_mutex_lock(&q->mutex);
-    if (!q->first_node)
-    {
-        q->first_node = node;
-        q->last_node = node;
-    }
-    else
-    {
-        q->last_node->next = node;
-        q->last_node = node;
-    }
-    sem_post(&q->sem_count);
+    append_nodes(q, node, node, 1);
+    pthread_mutex_unlock(&q->mutex);
+
+    return QUE_OK;
+}
+
+queue_err_t queue_push_batch(queue_h h, queue_node_t *first)
+{
+    queue_t *q = (queue_t *)h;
+    queue_node_t *last;
+    int count = 1;
+
+    if (!first)
+        return QUE_OK;
+
+    /* The chain is walked outside of the lock */
+    for (last = first; last->next; last = last->next)
+        count++;
+
+    pthread_mutex_lock(&q->mutex);
+    append_nodes(q, first, last, count);
     pthread_mutex_unlock(&q->mutex);
 
     return QUE_OK;
@@ -116,43 +185,32 @@ queue_node_t *queue_pop_timed(queue_h h, int timeout)
     queue_t *q = (queue_t *)h;
     queue_node_t *node;
     struct timespec wait_time;
+    int count, rc = 0;
 
     if (!timeout)
         return queue_pop(h);
 
     if (timeout != QUEUE_INFINITE_WAIT)
     {
-        clock_gettime(CLOCK_REALTIME, &wait_time);
+        clock_gettime(CLOCK_MONOTONIC, &wait_time);
         util_time_add(&wait_time, timeout);
-
-        if (sem_timedwait(&q->sem_count, &wait_time) == -1)
-        {
-            if (errno != ETIMEDOUT)
-            {
-                DBG_E("Function sem_timedwait failed\n");
-            }
-            return NULL;
-        }
-    }
-    else
-    {
-        sem_wait(&q->sem_count);
     }
 
     pthread_mutex_lock(&q->mutex);
-    if (!q->first_node)
+    while (!q->first_node && rc != ETIMEDOUT)
     {
-        pthread_mutex_unlock(&q->mutex);
-
-        DBG_E("Oops!!! Incorrect situation\n");
+        if (timeout != QUEUE_INFINITE_WAIT)
+            rc = pthread_cond_timedwait(&q->cond, &q->mutex, &wait_time);
+        else
+            rc = pthread_cond_wait(&q->cond, &q->mutex);
 
-        return NULL;
+        if (rc && rc != ETIMEDOUT)
+        {
+            DBG_E("Wait for the queue failed. Error: %d\n", rc);
+            break;
+        }
     }
-    node = q->first_node;
-    q->first_node = node->next;
-    if (!q->first_node)
-        q->last_node = NULL;
-
+    node = detach_nodes(q, 1, &count);
     pthread_mutex_unlock(&q->mutex);
 
     return node;
@@ -162,34 +220,36 @@ queue_node_t *queue_pop(queue_h h)
 {
     queue_node_t *node;
     queue_t *q = (queue_t *)h;
+    int count;
 
     pthread_mutex_lock(&q->mutex);
-    if (!q->first_node)
-    {
-        pthread_mutex_unlock(&q->mutex);
-        return NULL;
-    }
-    node = q->first_node;
-    /* Item found. Decrement the counter */
-    sem_wait(&q->sem_count); 
-
-    q->first_node = node->next;
-    if (!q->first_node)
-        q->last_node = NULL;
+    node = detach_nodes(q, 1, &count);
     pthread_mutex_unlock(&q->mutex);
 
     return node;
 }
 
+queue_node_t *queue_pop_batch(queue_h h, int max, int *count)
+{
+    queue_node_t *first;
+    queue_t *q = (queue_t *)h;
+    int tmp;
+
+    pthread_mutex_lock(&q->mutex);
+    first = detach_nodes(q, max, count ? count : &tmp);
+    pthread_mutex_unlock(&q->mutex);
+
+    return first;
+}
+
 int queue_count(queue_h h)
 {
     int count;
     queue_t *q = (queue_t *)h;
 
     pthread_mutex_lock(&q->mutex);
-    sem_getvalue(&q->sem_count, &count);
+    count = q->count;
     pthread_mutex_unlock(&q->mutex);
 
     return count;
 }
-
@@ -0,0 +1,331 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef CONFIG_FUTEX
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ring_queue.h"
+#include "log.h"
+#include "timeutils.h"
+
+/* Keep positions written by producers and consumers in different cache lines */
+#define CACHE_LINE  64
+
+typedef struct {
+    /* Written only by the owner of this end */
+    uint32_t pos;
+    /* Owner's copy of the opposite position. Saves a cache line miss while it is known there is room or items */
+    uint32_t other;
+    /* Owner of this end sleeps till the opposite position moves. The futex word */
+    uint32_t sleeping;
+    /* Serializes several threads on this end, if the queue was opened so */
+    int shared;
+    pthread_mutex_t lock;
+} __attribute__((aligned(CACHE_LINE))) ring_end_t;
+
+typedef struct {
+    void **slots;
+    uint32_t mask;
+
+    /* Next slot to pop and to push */
+    ring_end_t head;
+    ring_end_t tail;
+#ifndef CONFIG_FUTEX
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} ring_queue_t;
+
+static int64_t now_ms(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* Sleep while end->sleeping is set. timeout in ms or QUEUE_INFINITE_WAIT */
+static void wait_event(ring_queue_t *q, ring_end_t *end, int timeout)
+{
+#ifdef CONFIG_FUTEX
+    struct timespec wait_time;
+
+    if (timeout != QUEUE_INFINITE_WAIT)
+    {
+        wait_time.tv_sec = timeout / 1000;
+        wait_time.tv_nsec = timeout % 1000 * 1000000;
+    }
+    syscall(SYS_futex, &end->sleeping, FUTEX_WAIT_PRIVATE, 1,
+        (timeout != QUEUE_INFINITE_WAIT) ? &wait_time : NULL, NULL, 0);
+#else
+    struct timespec wait_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &wait_time);
+    util_time_add(&wait_time, timeout);
+
+    pthread_mutex_lock(&q->mutex);
+    if (__atomic_load_n(&end->sleeping, __ATOMIC_SEQ_CST))
+    {
+        if (timeout != QUEUE_INFINITE_WAIT)
+            pthread_cond_timedwait(&q->cond, &q->mutex, &wait_time);
+        else
+            pthread_cond_wait(&q->cond, &q->mutex);
+    }
+    pthread_mutex_unlock(&q->mutex);
+#endif
+}
+
+/*
+ * Called after the position of the opposite end moved. Costs nothing if the owner of the end is not sleeping. The
+ * flag is cleared by the first wake, so pushes or pops done before the sleeper runs make no more system calls
+ */
+static void wake_event(ring_queue_t *q, ring_end_t *end)
+{
+    /* Orders the position update before the check of the flag. Pairs with the fence in sleep_begin() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&end->sleeping, __ATOMIC_RELAXED) || !__atomic_exchange_n(&end->sleeping, 0,
+        __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+#ifdef CONFIG_FUTEX
+    syscall(SYS_futex, &end->sleeping, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&q->mutex);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+#endif
+}
+
+/* The flag is set before the position is checked again, so a move after the failed attempt sees it */
+static void sleep_begin(ring_end_t *end)
+{
+    __atomic_store_n(&end->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Other threads of a shared end may still sleep on the flag. Then the next wake clears it */
+static void sleep_end(ring_end_t *end)
+{
+    if (!end->shared)
+        __atomic_store_n(&end->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static int try_push(ring_queue_t *q, void *item)
+{
+    ring_end_t *tail = &q->tail;
+    uint32_t pos;
+
+    if (tail->shared)
+        pthread_mutex_lock(&tail->lock);
+
+    pos = tail->pos;
+    if (pos - tail->other > q->mask)
+    {
+        tail->other = __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE);
+        if (pos - tail->other > q->mask)
+        {
+            if (tail->shared)
+                pthread_mutex_unlock(&tail->lock);
+            return 0; /* Full */
+        }
+    }
+    q->slots[pos & q->mask] = item;
+    __atomic_store_n(&tail->pos, pos + 1, __ATOMIC_RELEASE);
+
+    if (tail->shared)
+        pthread_mutex_unlock(&tail->lock);
+
+    return 1;
+}
+
+static void *try_pop(ring_queue_t *q)
+{
+    ring_end_t *head = &q->head;
+    uint32_t pos;
+    void *item;
+
+    if (head->shared)
+        pthread_mutex_lock(&head->lock);
+
+    pos = head->pos;
+    if (pos == head->other)
+    {
+        head->other = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+        if (pos == head->other)
+        {
+            if (head->shared)
+                pthread_mutex_unlock(&head->lock);
+            return NULL; /* Empty */
+        }
+    }
+    item = q->slots[pos & q->mask];
+    __atomic_store_n(&head->pos, pos + 1, __ATOMIC_RELEASE);
+
+    if (head->shared)
+        pthread_mutex_unlock(&head->lock);
+
+    return item;
+}
+
+queue_err_t ring_queue_init(ring_queue_h *h, int size, int flags)
+{
+    ring_queue_t *q;
+    uint32_t count = 1;
+
+    while (count < size)
+        count <<= 1;
+
+    if (posix_memalign((void **)&q, CACHE_LINE, sizeof(ring_queue_t)))
+        return QUE_FAILED;
+    memset(q, 0, sizeof(ring_queue_t));
+
+    q->slots = (void **)calloc(count, sizeof(void *));
+    if (!q->slots)
+    {
+        free(q);
+        return QUE_FAILED;
+    }
+    q->mask = count - 1;
+
+    q->head.shared = (flags & RING_QUEUE_SHARED_POP) != 0;
+    q->tail.shared = (flags & RING_QUEUE_SHARED_PUSH) != 0;
+    pthread_mutex_init(&q->head.lock, NULL);
+    pthread_mutex_init(&q->tail.lock, NULL);
+#ifndef CONFIG_FUTEX
+    {
+        pthread_condattr_t attr;
+
+        pthread_mutex_init(&q->mutex, NULL);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&q->cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+#endif
+
+    *h = q;
+
+    return QUE_OK;
+}
+
+void ring_queue_uninit(ring_queue_h h)
+{
+    ring_queue_t *q = (ring_queue_t *)h;
+
+    if (!q)
+        return;
+
+#ifndef CONFIG_FUTEX
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->mutex);
+#endif
+    pthread_mutex_destroy(&q->head.lock);
+    pthread_mutex_destroy(&q->tail.lock);
+    free(q->slots);
+    free(q);
+}
+
+queue_err_t ring_queue_push(ring_queue_h h, void *item)
+{
+    ring_queue_t *q = (ring_queue_t *)h;
+
+    if (!try_push(q, item))
+    {
+        while (1)
+        {
+            sleep_begin(&q->tail);
+            if (try_push(q, item))
+                break;
+            wait_event(q, &q->tail, QUEUE_INFINITE_WAIT);
+        }
+        sleep_end(&q->tail);
+    }
+    wake_event(q, &q->head);
+
+    return QUE_OK;
+}
+
+void *ring_queue_pop(ring_queue_h h)
+{
+    ring_queue_t *q = (ring_queue_t *)h;
+    void *item;
+
+    item = try_pop(q);
+    if (item)
+        wake_event(q, &q->tail);
+
+    return item;
+}
+
+void *ring_queue_pop_timed(ring_queue_h h, int timeout)
+{
+    ring_queue_t *q = (ring_queue_t *)h;
+    void *item;
+    int64_t end_ms = 0;
+    int left = timeout;
+
+    item = try_pop(q);
+    if (!item && timeout)
+    {
+        if (timeout != QUEUE_INFINITE_WAIT)
+            end_ms = now_ms() + timeout;
+
+        while (1)
+        {
+            sleep_begin(&q->head);
+            if ((item = try_pop(q)) != NULL)
+                break;
+            if (timeout != QUEUE_INFINITE_WAIT)
+            {
+                left = (int)(end_ms - now_ms());
+                if (left <= 0)
+                    break;
+            }
+            wait_event(q, &q->head, left);
+        }
+        sleep_end(&q->head);
+    }
+    if (item)
+        wake_event(q, &q->tail);
+
+    return item;
+}
+
+int ring_queue_count(ring_queue_h h)
+{
+    ring_queue_t *q = (ring_queue_t *)h;
+    uint32_t head, tail;
+
+    head = __atomic_load_n(&q->head.pos, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&q->tail.pos, __ATOMIC_RELAXED);
+
+    /* Approximate while both ends move */
+    return ((int32_t)(tail - head) > 0) ? (int)(tail - head) : 0;
+}
@@ -64,7 +64,7 @@ ret_code_t util_time_sub(struct timespec *t, uint32_t ms)
     if (t->tv_nsec < ms_only * 1000000)
     {
         t->tv_sec--;
-        t->tv_nsec = 1000000000 + t->tv_nsec - ms_only;
+        t->tv_nsec = 1000000000 + t->tv_nsec - ms_only * 1000000;
     }
     else
     {
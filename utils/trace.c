@@ -0,0 +1,231 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "log.h"
+
+/* Spans kept per thread, 32 bytes each */
+#define TRACE_RING_EVENTS   32768
+
+typedef struct {
+    const char *name;
+    int64_t ts_us;
+    int64_t pts;
+    int32_t dur_us;
+} trace_event_t;
+
+/* Written by the owner thread only */
+typedef struct trace_ring_s {
+    struct trace_ring_s *next;
+    int tid;
+    char name[16];
+    unsigned int count;
+    trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+static int trace_enabled;
+static char *trace_file;
+static int64_t trace_start_us;
+
+static trace_ring_t *rings;
+/* Protects the list of rings. Taken once per thread on its first span */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_ring_t *thread_ring;
+
+static int64_t now_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static trace_ring_t *get_thread_ring(void)
+{
+    trace_ring_t *ring = thread_ring;
+
+    if (ring)
+        return ring;
+
+    ring = (trace_ring_t *)malloc(sizeof(trace_ring_t));
+    if (!ring)
+        return NULL;
+
+    ring->count = 0;
+    ring->tid = (int)syscall(SYS_gettid);
+    memset(ring->name, 0, sizeof(ring->name));
+    prctl(PR_GET_NAME, ring->name, 0, 0, 0);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    thread_ring = ring;
+
+    return ring;
+}
+
+/* Thread names come from prctl() and may contain any characters */
+static void write_json_string(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fprintf(f, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(f, "\\u%04x", *str);
+        else
+            fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+static ret_code_t write_trace(const char *file)
+{
+    FILE *f;
+    trace_ring_t *ring;
+    trace_event_t *ev;
+    unsigned int i, first;
+    int pid = (int)getpid();
+    const char *sep = "";
+
+    f = fopen(file, "w");
+    if (!f)
+    {
+        DBG_E("Can not open trace file %s\n", file);
+        return L_FAILED;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring; ring = ring->next)
+    {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", sep, pid,
+            ring->tid);
+        write_json_string(f, ring->name);
+        fprintf(f, "}}");
+        sep = ",";
+
+        /* Oldest spans are overwritten once the ring is full */
+        first = (ring->count > TRACE_RING_EVENTS) ? ring->count - TRACE_RING_EVENTS : 0;
+        for (i = first; i != ring->count; i++)
+        {
+            ev = &ring->events[i % TRACE_RING_EVENTS];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"lbmc\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,"
+                "\"dur\":%d", ev->name, pid, ring->tid, (long long)(ev->ts_us - trace_start_us), ev->dur_us);
+            if (ev->pts != TRACE_NOPTS)
+                fprintf(f, ",\"args\":{\"pts\":%lld}", (long long)ev->pts);
+            fprintf(f, "}");
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f))
+    {
+        DBG_E("Writing of trace file %s failed\n", file);
+        return L_FAILED;
+    }
+    DBG_I("Trace was written to %s\n", file);
+
+    return L_OK;
+}
+
+ret_code_t trace_init(const char *file)
+{
+    if (!file || !*file)
+        return L_FAILED;
+
+    trace_file = strdup(file);
+    if (!trace_file)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    trace_start_us = now_us();
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+
+    return L_OK;
+}
+
+void trace_uninit(void)
+{
+    trace_ring_t *ring;
+
+    if (!trace_file)
+        return;
+
+    /* Threads of the player are finished at this point */
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+    write_trace(trace_file);
+
+    pthread_mutex_lock(&rings_lock);
+    while ((ring = rings) != NULL)
+    {
+        rings = ring->next;
+        free(ring);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    thread_ring = NULL;
+
+    free(trace_file);
+    trace_file = NULL;
+}
+
+void trace_begin(trace_span_t *span, const char *name, int64_t pts)
+{
+    span->start_us = 0;
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED))
+        return;
+
+    span->name = name;
+    span->pts = pts;
+    span->start_us = now_us();
+}
+
+void trace_end(trace_span_t *span)
+{
+    trace_ring_t *ring;
+    trace_event_t *ev;
+
+    if (!span->start_us || !__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED))
+        return;
+
+    ring = get_thread_ring();
+    if (!ring)
+        return;
+
+    ev = &ring->events[ring->count % TRACE_RING_EVENTS];
+    ev->name = span->name;
+    ev->ts_us = span->start_us;
+    ev->pts = span->pts;
+    ev->dur_us = (int32_t)(now_us() - span->start_us);
+    ring->count++;
+}
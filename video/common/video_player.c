@@ -29,6 +29,15 @@
 
 #include <libavutil/avutil.h>
 
+#ifndef CONFIG_RASPBERRY_PI
+/* Frames requesting a longer wait are dropped */
+#define MAX_WAIT_MS     5000
+/* Late frames are still shown if nothing was drawn for this time */
+#define MAX_FREEZE_MS   500
+/* Display period used when the stream has no frame rate */
+#define DEF_FRAME_MS    40
+#endif
+
 int video_player_pause_toggle(video_player_h h)
 {
     video_player_common_ctx_t *ctx = (video_player_common_ctx_t *)h;
@@ -109,10 +118,121 @@ ret_code_t video_player_set_control(video_player_h h, control_ctx_h ctrl)
     return L_OK;
 }
 
+#ifndef CONFIG_RASPBERRY_PI
+static int64_t time_us(struct timespec *t)
+{
+    return (int64_t)t->tv_sec * 1000000 + t->tv_nsec / 1000;
+}
+
+static void drop_frame(video_player_common_ctx_t *ctx, media_buffer_t *buf)
+{
+    decode_release_video_buffer(ctx->demux_ctx, buf);
+    decode_count_video_frame(ctx->demux_ctx, 1);
+}
+
+static void start_schedule(video_player_common_ctx_t *ctx)
+{
+    int rate, scale;
+
+    /* Taken when the first frame comes, so the decoder delay is already behind */
+    clock_gettime(CLOCK_MONOTONIC, &ctx->base_time);
+    ctx->last_shown = ctx->base_time;
+
+    ctx->frame_ms = DEF_FRAME_MS;
+    if (decode_get_frame_rate(ctx->demux_ctx, &rate, &scale) == L_OK && rate > 0 && scale > 0)
+        ctx->frame_ms = 1000 * scale / rate;
+}
+
+/*
+ * Wait for the presentation time of the buffer. Frames are dropped when their display period is already over,
+ * if several are overdue the newest one is taken. With a vsync the frame is drawn half a refresh period before
+ * the blank it is assigned to, the swap waits for the blank itself. Return NULL if nothing has to be drawn.
+ */
+static media_buffer_t *schedule_frame(video_player_common_ctx_t *ctx, media_buffer_t *buf)
+{
+    struct timespec curr_time;
+    int64_t target;
+    int late, wait, period;
+
+    if (ctx->first_pkt)
+    {
+        start_schedule(ctx);
+        ctx->first_pkt = 0;
+        return buf;
+    }
+    if (buf->pts_ms == AV_NOPTS_VALUE)
+        return buf;
+
+    /* Video is the slave of the audio clock. Own timing is used if there is no audio or it is not started */
+    if (ctx->clock)
+        avclock_get_base(ctx->clock, &ctx->base_time);
+    clock_gettime(CLOCK_MONOTONIC, &curr_time);
+    late = util_time_diff(&curr_time, &ctx->base_time) - buf->pts_ms;
+    DBG_V("Current PTS=%lld late=%d\n", buf->pts_ms, late);
+#ifndef CONFIG_VIDEO_HW_DECODE
+    /* Compressed packets can not be dropped, every one is needed by the decoder */
+    decode_report_video_lateness(ctx->demux_ctx, late);
+    if (late > ctx->frame_ms)
+    {
+        media_buffer_t *next;
+
+        video_player_lock(ctx);
+        while (late > ctx->frame_ms && (next = decode_try_next_video_buffer(ctx->demux_ctx)) != NULL)
+        {
+            drop_frame(ctx, buf);
+            buf = next;
+            if (buf->pts_ms == AV_NOPTS_VALUE)
+                break;
+            late = util_time_diff(&curr_time, &ctx->base_time) - buf->pts_ms;
+        }
+        video_player_unlock(ctx);
+        if (buf->pts_ms == AV_NOPTS_VALUE)
+            return buf;
+
+        if (late > ctx->frame_ms && util_time_diff(&curr_time, &ctx->last_shown) < MAX_FREEZE_MS)
+        {
+            DBG_V("Frame PTS=%lld is %d ms late. Drop it\n", buf->pts_ms, late);
+            drop_frame(ctx, buf);
+            return NULL;
+        }
+    }
+#endif
+    if (-late > MAX_WAIT_MS)
+    {
+#ifdef CONFIG_VIDEO_HW_DECODE
+        /* A dropped packet would be a lost reference frame. Pass it to the decoder without waiting */
+        DBG_W("The packet requests %d msec wait. Pass it without waiting\n", -late);
+        return buf;
+#else
+        DBG_W("The frame requests %d msec wait. Drop it and continue\n", -late);
+        drop_frame(ctx, buf);
+        return NULL;
+#endif
+    }
+
+    wait = -late;
+    if (ctx->vsync && vsync_get_target(ctx->vsync, time_us(&ctx->base_time) + buf->pts_ms * 1000, &target,
+        &period) == L_OK)
+    {
+        wait = (target - period / 2 - time_us(&curr_time)) / 1000;
+    }
+    if (wait > 0)
+    {
+        DBG_V("Going to sleep for %d ms\n", wait);
+        msleep_wait(ctx->sched, wait);
+    }
+
+    return buf;
+}
+#endif
+
 void *player_main_routine(void *args)
 {
     media_buffer_t *buf;
     ret_code_t rc;
+#ifndef CONFIG_RASPBERRY_PI
+    int64_t pts_ms;
+#endif
     video_player_common_ctx_t *ctx = (video_player_common_ctx_t *)args;
 
     DBG_I("Video player task started.\n");
@@ -164,11 +284,24 @@ void *player_main_routine(void *args)
                 break;
             }
         }
-        rc = L_OK;
-        if (ctx->schedule)
-            rc = ctx->schedule(ctx, buf);
-        if (rc == L_OK)
-            ctx->draw_frame(ctx, buf);
+#ifndef CONFIG_RASPBERRY_PI
+        buf = schedule_frame(ctx, buf);
+        if (!buf)
+            continue;
+        pts_ms = buf->pts_ms;
+        ctx->draw_frame(ctx, buf);
+        decode_count_video_frame(ctx->demux_ctx, 0);
+        clock_gettime(CLOCK_MONOTONIC, &ctx->last_shown);
+        if (ctx->vsync)
+            vsync_swap_done(ctx->vsync, time_us(&ctx->last_shown));
+        if (pts_ms != AV_NOPTS_VALUE)
+        {
+            decode_report_video_present(ctx->demux_ctx,
+                time_us(&ctx->last_shown) - time_us(&ctx->base_time) - pts_ms * 1000);
+        }
+#else
+        ctx->draw_frame(ctx, buf);
+#endif
     }
 
     ctx->running = 0;
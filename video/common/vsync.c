@@ -0,0 +1,199 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "vsync.h"
+
+/* Swap intervals used for the estimation of the refresh period */
+#define VSYNC_SAMPLES       16
+#define VSYNC_MIN_US        4000
+#define VSYNC_MAX_US        200000
+/* Largest amount of refresh periods between two swaps taken as one interval */
+#define VSYNC_MAX_DIV       8
+/* Swaps far from the estimated blanks in a row before the period is estimated again */
+#define VSYNC_MAX_MISSES    16
+
+typedef struct {
+    int64_t period;
+    /* Estimated time of the last vertical blank */
+    int64_t last_vsync;
+    int64_t prev_swap;
+    int misses;
+
+    int64_t samples[VSYNC_SAMPLES];
+    int count;
+
+    /* Cadence state. Frame periods in blanks are accumulated and the whole part is taken */
+    int64_t last_pts;
+    int64_t last_target;
+    double carry;
+    int have_last;
+} vsync_ctx_t;
+
+static int64_t div_round(int64_t a, int64_t b)
+{
+    return (a >= 0) ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+static int64_t abs64(int64_t v)
+{
+    return (v < 0) ? -v : v;
+}
+
+/* Largest period the collected intervals are multiples of */
+static int64_t estimate_period(vsync_ctx_t *ctx)
+{
+    int64_t min = ctx->samples[0], cand, n;
+    int i, div;
+
+    for (i = 1; i < ctx->count; i++)
+    {
+        if (ctx->samples[i] < min)
+            min = ctx->samples[i];
+    }
+
+    for (div = 1; div <= VSYNC_MAX_DIV; div++)
+    {
+        cand = min / div;
+        if (cand < VSYNC_MIN_US)
+            break;
+        for (i = 0; i < ctx->count; i++)
+        {
+            n = div_round(ctx->samples[i], cand);
+            if (abs64(ctx->samples[i] - n * cand) > cand / 10)
+                break;
+        }
+        if (i == ctx->count)
+            return cand;
+    }
+
+    return 0;
+}
+
+ret_code_t vsync_init(vsync_h *h, int refresh_hz)
+{
+    vsync_ctx_t *ctx;
+
+    ctx = (vsync_ctx_t *)malloc(sizeof(vsync_ctx_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(vsync_ctx_t));
+    if (refresh_hz > 0)
+        ctx->period = 1000000 / refresh_hz;
+
+    *h = ctx;
+
+    return L_OK;
+}
+
+void vsync_uninit(vsync_h h)
+{
+    free(h);
+}
+
+void vsync_swap_done(vsync_h h, int64_t swap_us)
+{
+    vsync_ctx_t *ctx = (vsync_ctx_t *)h;
+    int64_t d, n, err, predicted;
+
+    if (!ctx)
+        return;
+
+    d = swap_us - ctx->prev_swap;
+    ctx->prev_swap = swap_us;
+    if (d < VSYNC_MIN_US || d > VSYNC_MAX_US)
+    {
+        /* The first swap or a pause. Keep the phase only */
+        ctx->last_vsync = swap_us;
+        return;
+    }
+
+    if (!ctx->period)
+    {
+        ctx->samples[ctx->count++] = d;
+        if (ctx->count < VSYNC_SAMPLES)
+            return;
+
+        ctx->period = estimate_period(ctx);
+        ctx->count = 0;
+        ctx->last_vsync = swap_us;
+        if (ctx->period)
+            DBG_I("Display refresh period %d us\n", (int)ctx->period);
+        return;
+    }
+
+    n = div_round(d, ctx->period);
+    err = d - n * ctx->period;
+    if (n < 1 || abs64(err) > ctx->period / 4)
+    {
+        ctx->last_vsync = swap_us;
+        if (++ctx->misses > VSYNC_MAX_MISSES)
+        {
+            DBG_W("Swaps do not follow the refresh period %d us. Estimate it again\n", (int)ctx->period);
+            ctx->period = 0;
+            ctx->misses = 0;
+        }
+        return;
+    }
+    ctx->misses = 0;
+
+    /* Slow correction of the period and the phase, a single late swap does not move the grid */
+    ctx->period += err / n / 16;
+    predicted = ctx->last_vsync + div_round(swap_us - ctx->last_vsync, ctx->period) * ctx->period;
+    ctx->last_vsync = predicted + (swap_us - predicted) / 4;
+}
+
+ret_code_t vsync_get_target(vsync_h h, int64_t pts_us, int64_t *target_us, int *period_us)
+{
+    vsync_ctx_t *ctx = (vsync_ctx_t *)h;
+    int64_t target = 0, n;
+
+    if (!ctx || !ctx->period)
+        return L_FAILED;
+
+    if (ctx->have_last)
+    {
+        ctx->carry += (double)(pts_us - ctx->last_pts) / ctx->period;
+        n = (int64_t)(ctx->carry + 0.5);
+        if (n < 1)
+            n = 1;
+        ctx->carry -= n;
+        target = ctx->last_target + n * ctx->period;
+    }
+    /* Start of the playback, a seek or a drift of the cadence. Take the nearest blank */
+    if (!ctx->have_last || abs64(target - pts_us) > ctx->period)
+    {
+        target = ctx->last_vsync + div_round(pts_us - ctx->last_vsync, ctx->period) * ctx->period;
+        ctx->carry = 0;
+    }
+
+    ctx->last_pts = pts_us;
+    ctx->last_target = target;
+    ctx->have_last = 1;
+
+    *target_us = target;
+    *period_us = (int)ctx->period;
+
+    return L_OK;
+}
@@ -24,17 +24,20 @@
 #include <stdio.h>
 
 #include <GL/glew.h>
+#include <GL/glxew.h>
 #include <GL/gl.h>
 #include <GL/glut.h>
 #include <GL/freeglut_ext.h>
 
 #include <libavutil/avutil.h>
+#include <libavutil/pixdesc.h>
 
 #include "log.h"
 #include "decode.h"
 #include "video_player.h"
 #include "timeutils.h"
 #include "ft_text.h"
+#include "trace.h"
 
 static const char *shader_vert =
     "#version 300 es\n"
@@ -64,6 +67,34 @@ static const char *shader_frag =
     "    }"
     "}";
 
+/* Planar YUV to RGB. The matrix and offsets depend on a color space and a range of the stream */
+static const char *shader_frag_yuv =
+    "#version 300 es\n"
+    "in highp vec2 texCoord;"
+    "out highp vec4 outColor;"
+    "uniform sampler2D tex_y;"
+    "uniform sampler2D tex_u;"
+    "uniform sampler2D tex_v;"
+    "uniform highp mat3 yuv_matrix;"
+    "uniform highp vec3 yuv_offset;"
+    "void main() {"
+    "    highp vec3 yuv = vec3(texture(tex_y, texCoord).r, texture(tex_u, texCoord).r,"
+    "        texture(tex_v, texCoord).r) - yuv_offset;"
+    "    outColor = vec4(clamp(yuv_matrix * yuv, 0.0, 1.0), 1.0);"
+    "}";
+
+/* Supported pixel formats. All except RGBA are drawn by the YUV shader */
+static const enum AVPixelFormat gl_formats[] = {
+    AV_PIX_FMT_YUV420P,
+    AV_PIX_FMT_YUVJ420P,
+    AV_PIX_FMT_YUV422P,
+    AV_PIX_FMT_YUVJ422P,
+    AV_PIX_FMT_YUV444P,
+    AV_PIX_FMT_YUVJ444P,
+    AV_PIX_FMT_RGBA,
+    AV_PIX_FMT_NONE
+};
+
 static GLfloat vertices[] = {
     /* Position   Texcoords */
     -1.0f,  1.0f, 0.0f, 0.0f, /* Top-left */
@@ -96,12 +127,33 @@ typedef struct {
 
     GLuint tex_frame;
     int win;
+
+    /* Planar YUV path */
+    int yuv;
+    GLuint fs_yuv;
+    GLuint sp_yuv;
+    GLuint tex_yuv[3];
+    int chroma_w_shift;
+    int chroma_h_shift;
+
+    /* Size of frame textures. Decoder scales frames down to the viewport */
+    int frame_width;
+    int frame_height;
+    /* Viewport size reported to the decoder */
+    int vp_width;
+    int vp_height;
 } player_ctx_t;
 
 static int gl_flush_buffers(void)
 {
+    trace_span_t span;
+
     glFinish();
+    trace_begin(&span, "present", TRACE_NOPTS);
     glutSwapBuffers();
+    /* With a swap interval returns after the vertical blank, the player takes it as the present time */
+    glFinish();
+    trace_end(&span);
 
     glutMainLoopEvent();
 
@@ -112,6 +164,22 @@ static void display(void)
 {
 }
 
+/* Make the swap wait for the vertical blank. Return 0 if the driver does not allow it */
+static int gl_set_swap_interval(void)
+{
+    if (GLXEW_EXT_swap_control)
+    {
+        glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(), 1);
+        return 1;
+    }
+    if (GLXEW_MESA_swap_control)
+        return !glXSwapIntervalMESA(1);
+    if (GLXEW_SGI_swap_control)
+        return !glXSwapIntervalSGI(1);
+
+    return 0;
+}
+
 static void reshape(int w, int h)
 {
 }
@@ -201,14 +269,167 @@ static ret_code_t create_shader(player_ctx_t *ctx)
     glEnableVertexAttribArray(ctx->tex_attrib);
     glVertexAttribPointer(ctx->tex_attrib, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
 
+    /* YUV program shares the vertex shader and the vertex array */
+    ctx->fs_yuv = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(ctx->fs_yuv, 1, &shader_frag_yuv, NULL);
+    glCompileShader(ctx->fs_yuv);
+
+    glGetShaderiv(ctx->fs_yuv, GL_COMPILE_STATUS, &status);
+    DBG_I("YUV fragment copmile status is %s\n", status ? "OK" : "FAILED");
+    print_log(ctx->fs_yuv);
+
+    ctx->sp_yuv = glCreateProgram();
+    glAttachShader(ctx->sp_yuv, ctx->vs);
+    glAttachShader(ctx->sp_yuv, ctx->fs_yuv);
+    glBindAttribLocation(ctx->sp_yuv, posAttrib, "position");
+    glBindAttribLocation(ctx->sp_yuv, ctx->tex_attrib, "texcoord");
+    glBindFragDataLocation(ctx->sp_yuv, 0, "outColor");
+    glLinkProgram(ctx->sp_yuv);
+
+    glGetProgramiv(ctx->sp_yuv, GL_LINK_STATUS, &status);
+    DBG_I("YUV link status is %s\n", status ? "OK" : "FAILED");
+    print_log(ctx->sp_yuv);
+
     return L_OK;
 }
 
+/* Load BT.601 or BT.709 coefficients to the YUV program */
+static void set_yuv_matrix(player_ctx_t *ctx, enum AVPixelFormat pix_fmt)
+{
+    enum AVColorSpace space = AVCOL_SPC_UNSPECIFIED;
+    enum AVColorRange range = AVCOL_RANGE_UNSPECIFIED;
+    GLfloat matrix[9], offset[3];
+    float kr, kb, kg, ys, cs;
+    int bt709, full_range;
+
+    decode_get_color_info(ctx->common.demux_ctx, &space, &range);
+
+    if (space == AVCOL_SPC_BT709)
+        bt709 = 1;
+    else if (space == AVCOL_SPC_BT470BG || space == AVCOL_SPC_SMPTE170M)
+        bt709 = 0;
+    else
+        bt709 = (ctx->height > 576); /* Not signalled. Guess by the resolution */
+
+    full_range = (range == AVCOL_RANGE_JPEG || pix_fmt == AV_PIX_FMT_YUVJ420P || pix_fmt == AV_PIX_FMT_YUVJ422P ||
+        pix_fmt == AV_PIX_FMT_YUVJ444P);
+
+    kr = bt709 ? 0.2126 : 0.299;
+    kb = bt709 ? 0.0722 : 0.114;
+    kg = 1.0 - kr - kb;
+    ys = full_range ? 1.0 : 255.0 / 219.0;
+    cs = full_range ? 1.0 : 255.0 / 224.0;
+
+    /* Column major: Y, U and V columns */
+    matrix[0] = ys;
+    matrix[1] = ys;
+    matrix[2] = ys;
+    matrix[3] = 0.0;
+    matrix[4] = -cs * 2.0 * kb * (1.0 - kb) / kg;
+    matrix[5] = cs * 2.0 * (1.0 - kb);
+    matrix[6] = cs * 2.0 * (1.0 - kr);
+    matrix[7] = -cs * 2.0 * kr * (1.0 - kr) / kg;
+    matrix[8] = 0.0;
+
+    offset[0] = full_range ? 0.0 : 16.0 / 255.0;
+    offset[1] = 128.0 / 255.0;
+    offset[2] = 128.0 / 255.0;
+
+    glUseProgram(ctx->sp_yuv);
+    glUniform1i(glGetUniformLocation(ctx->sp_yuv, "tex_y"), 0);
+    glUniform1i(glGetUniformLocation(ctx->sp_yuv, "tex_u"), 1);
+    glUniform1i(glGetUniformLocation(ctx->sp_yuv, "tex_v"), 2);
+    glUniformMatrix3fv(glGetUniformLocation(ctx->sp_yuv, "yuv_matrix"), 1, GL_FALSE, matrix);
+    glUniform3fv(glGetUniformLocation(ctx->sp_yuv, "yuv_offset"), 1, offset);
+    glUseProgram(ctx->sp);
+
+    DBG_I("YUV render: %s %s range\n", bt709 ? "BT.709" : "BT.601", full_range ? "full" : "limited");
+}
+
+static void plane_size(player_ctx_t *ctx, int plane, int *w, int *h)
+{
+    if (!plane)
+    {
+        *w = ctx->frame_width;
+        *h = ctx->frame_height;
+        return;
+    }
+    /* Chroma planes are rounded up for odd sizes */
+    *w = (ctx->frame_width + (1 << ctx->chroma_w_shift) - 1) >> ctx->chroma_w_shift;
+    *h = (ctx->frame_height + (1 << ctx->chroma_h_shift) - 1) >> ctx->chroma_h_shift;
+}
+
+static void init_yuv_textures(player_ctx_t *ctx)
+{
+    int i, w, h;
+
+    glGenTextures(3, ctx->tex_yuv);
+    for (i = 0; i < 3; i++)
+    {
+        plane_size(ctx, i, &w, &h);
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ctx->tex_yuv[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, w, h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/* Frame size changed after the viewport resizing */
+static void resize_frame_textures(player_ctx_t *ctx, int width, int height)
+{
+    int i, w, h;
+
+    DBG_I("Frame texture size %dx%d\n", width, height);
+    ctx->frame_width = width;
+    ctx->frame_height = height;
+
+    if (!ctx->yuv)
+    {
+        glBindTexture(GL_TEXTURE_2D, ctx->tex_frame);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        return;
+    }
+    for (i = 0; i < 3; i++)
+    {
+        plane_size(ctx, i, &w, &h);
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ctx->tex_yuv[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, w, h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+static void upload_yuv_planes(player_ctx_t *ctx, media_buffer_t *buff)
+{
+    int i, w, h;
+
+    for (i = 0; i < 3; i++)
+    {
+        plane_size(ctx, i, &w, &h);
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, ctx->tex_yuv[i]);
+        /* Decoder planes may be padded */
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, buff->s.video.linesize[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_LUMINANCE, GL_UNSIGNED_BYTE, buff->s.video.buffer[i]);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
 static void delete_shader(player_ctx_t *ctx)
 {
     glDeleteShader(ctx->vs);
     glDeleteShader(ctx->fs);
     glDeleteProgram(ctx->sp);
+    glDeleteShader(ctx->fs_yuv);
+    glDeleteProgram(ctx->sp_yuv);
 
     glDeleteBuffers(1, &ctx->ebo);
     glDeleteBuffers(1, &ctx->vbo);
@@ -342,6 +563,7 @@ static ret_code_t gl_init(video_player_h h)
     int argc = 1;
     char *argv[] = {""};
     player_ctx_t *ctx = (player_ctx_t *)h;
+    enum AVPixelFormat pix_fmt;
 
     glutInit(&argc, argv);
     glutInitContextVersion(3,0);
@@ -355,6 +577,13 @@ static ret_code_t gl_init(video_player_h h)
 
     create_shader(ctx);
 
+    /* The refresh rate is not known to GLUT, the presentation scheduler estimates it */
+    if (!gl_set_swap_interval() || vsync_init(&ctx->common.vsync, 0))
+    {
+        DBG_W("No vsync. Frames are shown at PTS time\n");
+        ctx->common.vsync = NULL;
+    }
+
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glShadeModel(GL_SMOOTH);
 
@@ -363,6 +592,20 @@ static ret_code_t gl_init(video_player_h h)
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+    if (decode_negotiate_video_format(ctx->common.demux_ctx, ctx->common.pix_fmts, &pix_fmt))
+        return L_FAILED;
+    ctx->frame_width = ctx->width;
+    ctx->frame_height = ctx->height;
+
+    if (pix_fmt != AV_PIX_FMT_RGBA)
+    {
+        /* Planes go to the GPU as is. Color conversion is done by the shader */
+        av_pix_fmt_get_chroma_sub_sample(pix_fmt, &ctx->chroma_w_shift, &ctx->chroma_h_shift);
+        ctx->yuv = 1;
+        init_yuv_textures(ctx);
+        set_yuv_matrix(ctx, pix_fmt);
+    }
+
     glGenTextures(1, &ctx->tex_frame);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, ctx->tex_frame);
@@ -372,7 +615,11 @@ static ret_code_t gl_init(video_player_h h)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ctx->width, ctx->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (!ctx->yuv)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ctx->frame_width, ctx->frame_height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+            NULL);
+    }
 
 #ifdef CONFIG_GL_TEXT_RENDERER
     if (ft_text_init(&ctx->ft_lib))
@@ -396,8 +643,11 @@ static void gl_uninit(video_player_h h)
     player_ctx_t *ctx = (player_ctx_t *)h;
 
     msleep_uninit(ctx->common.sched);
+    vsync_uninit(ctx->common.vsync);
 
     glDeleteTextures(1, &ctx->tex_frame);
+    if (ctx->yuv)
+        glDeleteTextures(3, ctx->tex_yuv);
 #ifdef CONFIG_GL_TEXT_RENDERER
     if (ctx->last_text)
         free(ctx->last_text);
@@ -433,6 +683,13 @@ static void gl_set_viewport(player_ctx_t *ctx)
         hpic = ctx->height * xscale;
         glViewport(0, (h - hpic) / 2, wpic, hpic);
     }
+
+    if (wpic != ctx->vp_width || hpic != ctx->vp_height)
+    {
+        ctx->vp_width = wpic;
+        ctx->vp_height = hpic;
+        decode_set_video_output_size(ctx->common.demux_ctx, wpic, hpic);
+    }
 }
 
 #ifdef CONFIG_GL_TEXT_RENDERER
@@ -442,15 +699,33 @@ static int frames = 0;
 static ret_code_t gl_draw_frame(video_player_h h, media_buffer_t *buff)
 {
     player_ctx_t *ctx = (player_ctx_t *)h;
+    trace_span_t span;
 
     decode_set_current_playing_pts(ctx->common.demux_ctx, buff->pts_ms);
 
     gl_set_viewport(ctx);
+
+    if (buff->s.video.width != ctx->frame_width || buff->s.video.height != ctx->frame_height)
+        resize_frame_textures(ctx, buff->s.video.width, buff->s.video.height);
       
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(ctx->sp, "tex"), 0);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ctx->width, ctx->height, GL_RGBA, GL_UNSIGNED_BYTE,
-        buff->s.video.buffer[0]);
+    /* Uploads are queued by the driver, the time shows a copy or a wait for the previous frame */
+    trace_begin(&span, "glTexSubImage2D", buff->pts_ms);
+    if (ctx->yuv)
+    {
+        glUseProgram(ctx->sp_yuv);
+        upload_yuv_planes(ctx, buff);
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, ctx->tex_frame);
+        glUniform1i(glGetUniformLocation(ctx->sp, "tex"), 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, buff->s.video.linesize[0] / 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ctx->frame_width, ctx->frame_height, GL_RGBA, GL_UNSIGNED_BYTE,
+            buff->s.video.buffer[0]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    trace_end(&span);
 
 #ifdef CONFIG_GL_TEXT_RENDERER
     vertices[0] = -1.0; vertices[1] = 1.0;
@@ -465,6 +740,8 @@ static ret_code_t gl_draw_frame(video_player_h h, media_buffer_t *buff)
     glEnable(GL_TEXTURE_2D);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    if (ctx->yuv)
+        glUseProgram(ctx->sp);
 
 #ifdef CONFIG_GL_TEXT_RENDERER
     frames++;
@@ -527,39 +804,6 @@ static ret_code_t gl_seek(video_player_h h, seek_direction_t dir, int32_t seek)
     return L_OK;
 }
 
-static ret_code_t gl_schedule(video_player_h h, media_buffer_t *buf)
-{
-    player_ctx_t *ctx = (player_ctx_t *)h;
-
-    if (ctx->common.first_pkt)
-    {
-        clock_gettime(CLOCK_MONOTONIC, &ctx->common.base_time);
-        ctx->common.first_pkt = 0;
-    }
-    else if (buf->pts_ms != AV_NOPTS_VALUE)
-    {
-        struct timespec curr_time;
-        int diff;
-
-        clock_gettime(CLOCK_MONOTONIC, &curr_time);
-        diff = util_time_diff(&curr_time, &ctx->common.base_time);
-        DBG_V("Current PTS=%lld time diff=%d\n", buf->pts_ms, diff);
-        if (diff > 0 && buf->pts_ms > diff)
-        {
-            diff = buf->pts_ms - diff;
-            if (diff > 5000)
-            {
-                DBG_W("The frame requests %d msec wait. Drop it and continue\n", diff);
-                decode_release_video_buffer(ctx->common.demux_ctx, buf);
-                return L_FAILED;
-            }
-            DBG_V("Going to sleep for %d ms\n", diff);
-            msleep_wait(ctx->common.sched, diff);
-        }
-    }
-    return L_OK;
-}
-
 ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *clock)
 {
     player_ctx_t *ctx;
@@ -576,6 +820,7 @@ ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *c
     }
     memset(ctx, 0, sizeof(player_ctx_t));
     ctx->common.demux_ctx = h;
+    ctx->common.clock = clock;
 
     if (devode_get_video_size(h, &width, &height))
     {
@@ -586,13 +831,13 @@ ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *c
     ctx->width = width;
     ctx->height = height;
 
+    ctx->common.pix_fmts = gl_formats;
     ctx->common.init = gl_init;
     ctx->common.uninit = gl_uninit;
     ctx->common.draw_frame = gl_draw_frame;
     ctx->common.idle = gl_idle;
     ctx->common.pause = gl_pause_toggle;
     ctx->common.seek = gl_seek;
-    ctx->common.schedule = gl_schedule;
 
     /* Use default scheduler. Set SCHED_RR or SCHED_FIFO request root access */
     pthread_attr_init(&attr);
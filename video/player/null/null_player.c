@@ -0,0 +1,157 @@
+/*
+ *      Copyright (C) 2016  Andrew Fateyev
+ *      andrew.ftv@gmail.com
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+
+#include "log.h"
+#include "decode.h"
+#include "video_player.h"
+#include "timeutils.h"
+
+/*
+ * Video sink for the compressed stream on PC. Packets are paced by PTS, read and dropped. Lets to check
+ * the demuxer path of the hardware decoding without the hardware.
+ */
+
+typedef struct {
+    video_player_common_ctx_t common;
+
+    uint64_t packets;
+    uint64_t bytes;
+    /* Keeps the payload reading from being optimized out */
+    uint32_t check;
+} player_ctx_t;
+
+static void uninit_null(video_player_h h)
+{
+    player_ctx_t *ctx = (player_ctx_t *)h;
+
+    msleep_uninit(ctx->common.sched);
+
+    DBG_I("Null sink: %llu buffers, %llu bytes, check %08x\n", (unsigned long long)ctx->packets,
+        (unsigned long long)ctx->bytes, ctx->check);
+}
+
+static int init_null(video_player_h h)
+{
+    player_ctx_t *ctx = (player_ctx_t *)h;
+
+    /* The sink does not keep buffers after drawing, so references to demuxer packets are enough */
+    decode_set_packet_passthrough(ctx->common.demux_ctx, 1);
+    if (decode_setup_video_buffers(ctx->common.demux_ctx, VIDEO_BUFFERS, 1, 80 * 1024) != L_OK)
+        return L_FAILED;
+
+    ctx->common.first_pkt = 1;
+    msleep_init(&ctx->common.sched);
+
+    decode_start_read(ctx->common.demux_ctx);
+
+    return 0;
+}
+
+static int draw_frame_null(video_player_h h, media_buffer_t *buf)
+{
+    player_ctx_t *ctx = (player_ctx_t *)h;
+    int i;
+
+    /* Touch every cache line as a decoder would */
+    for (i = 0; i < buf->size; i += 64)
+        ctx->check += buf->s.video.data[i];
+
+    ctx->bytes += buf->size;
+    if (buf->status == MB_FULL_STATUS)
+        ctx->packets++;
+
+    decode_release_video_buffer(ctx->common.demux_ctx, buf);
+
+    return 0;
+}
+
+static ret_code_t seek_null(video_player_h h, seek_direction_t dir, int32_t seek)
+{
+    player_ctx_t *ctx = (player_ctx_t *)h;
+
+    if (dir == L_SEEK_FORWARD)
+        util_time_sub(&ctx->common.base_time, seek);
+    else if (dir == L_SEEK_BACKWARD)
+        util_time_add(&ctx->common.base_time, seek);
+
+    return L_OK;
+}
+
+static int pause_toggle_null(video_player_h h)
+{
+    player_ctx_t *ctx = (player_ctx_t *)h;
+
+    if (!ctx)
+        return 0;
+
+    if (ctx->common.state == PLAYER_PAUSE)
+    {
+        struct timespec end_pause;
+        uint32_t diff;
+
+        ctx->common.state = PLAYER_PLAY;
+        clock_gettime(CLOCK_MONOTONIC, &end_pause);
+        diff = util_time_diff(&end_pause, &ctx->common.start_pause);
+        util_time_add(&ctx->common.base_time, diff);
+    }
+    else
+    {
+        ctx->common.state = PLAYER_PAUSE;
+        clock_gettime(CLOCK_MONOTONIC, &ctx->common.start_pause);
+    }
+
+    return (ctx->common.state == PLAYER_PAUSE);
+}
+
+ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *clock)
+{
+    player_ctx_t *ctx;
+
+    ctx = (player_ctx_t *)malloc(sizeof(player_ctx_t));
+    if (!ctx)
+    {
+        DBG_E("Memory allocation failed\n");
+        return L_FAILED;
+    }
+    memset(ctx, 0, sizeof(player_ctx_t));
+    ctx->common.demux_ctx = h;
+    ctx->common.clock = clock;
+
+    ctx->common.init = init_null;
+    ctx->common.uninit = uninit_null;
+    ctx->common.draw_frame = draw_frame_null;
+    ctx->common.pause = pause_toggle_null;
+    ctx->common.seek = seek_null;
+
+    if (pthread_create(&ctx->common.task, NULL, player_main_routine, ctx))
+    {
+        DBG_E("Create thread falled\n");
+        free(ctx);
+        return L_FAILED;
+    }
+    *player_ctx = ctx;
+
+    return L_OK;
+}
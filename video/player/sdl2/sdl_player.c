@@ -33,6 +33,10 @@
 #include "timeutils.h"
 #include "control.h"
 #include "guiapi.h"
+#include "trace.h"
+
+/* Size of the renderer formats list */
+#define TEXTURE_FORMATS_MAX 8
 
 typedef struct {
     video_player_common_ctx_t common;
@@ -43,6 +47,11 @@ typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    /* Texture format negotiated with the decoder */
+    Uint32 sdl_fmt;
+    /* Texture size follows the decoder output scaled to the viewport */
+    int tex_width;
+    int tex_height;
 
     image_h img_pause;
     SDL_Texture *icon;
@@ -50,6 +59,113 @@ typedef struct {
     SDL_Rect vp_rect;
 } player_ctx_t;
 
+/* Decoder formats which can be streamed to a texture without a conversion. Ordered by preference: a YUV texture
+ * is cheaper than RGBA even if the decoder output has to be converted */
+static const struct {
+    enum AVPixelFormat pix_fmt;
+    Uint32 sdl_fmt;
+} texture_formats[] = {
+    { AV_PIX_FMT_YUV420P, SDL_PIXELFORMAT_IYUV },
+#if SDL_VERSION_ATLEAST(2, 0, 8)
+    /* Full range. Older SDL converts YUV textures as limited range only, so swscale converts it */
+    { AV_PIX_FMT_YUVJ420P, SDL_PIXELFORMAT_IYUV },
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+    { AV_PIX_FMT_NV12, SDL_PIXELFORMAT_NV12 },
+#endif
+    { AV_PIX_FMT_RGBA, SDL_PIXELFORMAT_ABGR8888 },
+    { AV_PIX_FMT_NONE, SDL_PIXELFORMAT_UNKNOWN }
+};
+
+static int is_texture_format_supported(SDL_RendererInfo *info, Uint32 sdl_fmt)
+{
+    int i;
+
+    for (i = 0; i < info->num_texture_formats; i++)
+    {
+        if (info->texture_formats[i] == sdl_fmt)
+            return 1;
+    }
+    return 0;
+}
+
+/* SDL converts YUV textures as limited range BT.601 unless told otherwise. Has to be set before textures are created */
+static void set_yuv_conversion(player_ctx_t *ctx, enum AVPixelFormat pix_fmt)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 8)
+    enum AVColorSpace space = AVCOL_SPC_UNSPECIFIED;
+    enum AVColorRange range = AVCOL_RANGE_UNSPECIFIED;
+    SDL_YUV_CONVERSION_MODE mode;
+
+    decode_get_color_info(ctx->common.demux_ctx, &space, &range);
+
+    if (range == AVCOL_RANGE_JPEG || pix_fmt == AV_PIX_FMT_YUVJ420P)
+        mode = SDL_YUV_CONVERSION_JPEG;
+    else if (space == AVCOL_SPC_BT709)
+        mode = SDL_YUV_CONVERSION_BT709;
+    else if (space == AVCOL_SPC_BT470BG || space == AVCOL_SPC_SMPTE170M)
+        mode = SDL_YUV_CONVERSION_BT601;
+    else
+        mode = SDL_YUV_CONVERSION_AUTOMATIC; /* Not signalled. Chosen by the resolution */
+
+    SDL_SetYUVConversionMode(mode);
+    DBG_I("YUV conversion mode %d\n", mode);
+#endif
+}
+
+/* Advertise formats of the renderer to the decoder and select a texture format */
+static ret_code_t negotiate_texture_format(player_ctx_t *ctx)
+{
+    SDL_RendererInfo info;
+    enum AVPixelFormat out_fmt;
+    int i, count = 0;
+
+    if (SDL_GetRendererInfo(ctx->renderer, &info))
+    {
+        DBG_E("Unable to get renderer info: %s\n", SDL_GetError());
+        return L_FAILED;
+    }
+
+    for (i = 0; texture_formats[i].pix_fmt != AV_PIX_FMT_NONE; i++)
+    {
+        if (is_texture_format_supported(&info, texture_formats[i].sdl_fmt))
+            ctx->pix_fmts[count++] = texture_formats[i].pix_fmt;
+    }
+    ctx->pix_fmts[count] = AV_PIX_FMT_NONE;
+    ctx->common.pix_fmts = ctx->pix_fmts;
+
+    if (decode_negotiate_video_format(ctx->common.demux_ctx, ctx->common.pix_fmts, &out_fmt))
+        return L_FAILED;
+
+    for (i = 0; texture_formats[i].pix_fmt != out_fmt; i++)
+        ;
+    ctx->sdl_fmt = texture_formats[i].sdl_fmt;
+    if (out_fmt != AV_PIX_FMT_RGBA)
+        set_yuv_conversion(ctx, out_fmt);
+    DBG_I("Renderer %s texture format %s\n", info.name, SDL_GetPixelFormatName(ctx->sdl_fmt));
+
+    return L_OK;
+}
+
+/* Presentation is aligned to vertical blanks if the renderer waits for them */
+static void init_vsync(player_ctx_t *ctx)
+{
+    SDL_RendererInfo info;
+    SDL_DisplayMode mode;
+    int refresh_hz = 0;
+
+    if (SDL_GetRendererInfo(ctx->renderer, &info) || !(info.flags & SDL_RENDERER_PRESENTVSYNC))
+    {
+        DBG_W("No vsync. Frames are shown at PTS time\n");
+        return;
+    }
+    if (!SDL_GetWindowDisplayMode(ctx->window, &mode))
+        refresh_hz = mode.refresh_rate;
+
+    if (vsync_init(&ctx->common.vsync, refresh_hz))
+        ctx->common.vsync = NULL;
+}
+
 static event_code_t get_event_callback(control_ctx_h h, uint32_t *data)
 {
     player_ctx_t *ctx = (player_ctx_t *)control_get_user_data(h);
@@ -74,6 +190,7 @@ static void uninit_sdl(video_player_h h)
     player_ctx_t *ctx = (player_ctx_t *)h;
 
     msleep_uninit(ctx->common.sched);
+    vsync_uninit(ctx->common.vsync);
 
     if (ctx->texture)
         SDL_DestroyTexture(ctx->texture);
@@ -113,16 +230,22 @@ static int init_sdl(video_player_h h)
     /* Set "best" scale quality */
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "2");
 
-    ctx->renderer = SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_ACCELERATED);
+    ctx->renderer = SDL_CreateRenderer(ctx->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!ctx->renderer)
     {
         DBG_E("Unable to create renderer\n");
         return -1;
     }
+    init_vsync(ctx);
     SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 0x80);
 
-    ctx->texture = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,  ctx->width,
+    if (negotiate_texture_format(ctx))
+        return -1;
+
+    ctx->texture = SDL_CreateTexture(ctx->renderer, ctx->sdl_fmt, SDL_TEXTUREACCESS_STREAMING,  ctx->width,
         ctx->height);
+    ctx->tex_width = ctx->width;
+    ctx->tex_height = ctx->height;
     if (!ctx->texture)
     {
         DBG_E("Unable to create texture\n");
@@ -182,6 +305,7 @@ static void event_sdl(player_ctx_t *ctx, int *is_min)
                     ctx->vp_rect.x = 0;
                     ctx->vp_rect.y = (h - ctx->vp_rect.h) / 2;
                 }
+                decode_set_video_output_size(ctx->common.demux_ctx, ctx->vp_rect.w, ctx->vp_rect.h);
                 break;
             default:
                 break;
@@ -246,15 +370,52 @@ static int draw_frame_sdl(video_player_h h, media_buffer_t *buf)
 {
     int win_minimized = 0;
     player_ctx_t *ctx = (player_ctx_t *)h;
+    trace_span_t span;
 
     event_sdl(ctx, &win_minimized);
     if (win_minimized)
         return 0;
 
-    SDL_UpdateTexture(ctx->texture, NULL, buf->s.video.buffer[0], ctx->width * 4);
+    if (buf->s.video.width != ctx->tex_width || buf->s.video.height != ctx->tex_height)
+    {
+        DBG_I("Texture size %dx%d\n", buf->s.video.width, buf->s.video.height);
+        SDL_DestroyTexture(ctx->texture);
+        ctx->texture = SDL_CreateTexture(ctx->renderer, ctx->sdl_fmt, SDL_TEXTUREACCESS_STREAMING,
+            buf->s.video.width, buf->s.video.height);
+        if (!ctx->texture)
+        {
+            DBG_E("Unable to create texture\n");
+            decode_release_video_buffer(ctx->common.demux_ctx, buf);
+            return -1;
+        }
+        SDL_SetTextureBlendMode(ctx->texture, SDL_BLENDMODE_BLEND);
+        ctx->tex_width = buf->s.video.width;
+        ctx->tex_height = buf->s.video.height;
+    }
+
+    trace_begin(&span, "SDL_UpdateTexture", buf->pts_ms);
+    switch (ctx->sdl_fmt)
+    {
+    case SDL_PIXELFORMAT_IYUV:
+        SDL_UpdateYUVTexture(ctx->texture, NULL, buf->s.video.buffer[0], buf->s.video.linesize[0],
+            buf->s.video.buffer[1], buf->s.video.linesize[1], buf->s.video.buffer[2], buf->s.video.linesize[2]);
+        break;
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+    case SDL_PIXELFORMAT_NV12:
+        SDL_UpdateNVTexture(ctx->texture, NULL, buf->s.video.buffer[0], buf->s.video.linesize[0],
+            buf->s.video.buffer[1], buf->s.video.linesize[1]);
+        break;
+#endif
+    default:
+        SDL_UpdateTexture(ctx->texture, NULL, buf->s.video.buffer[0], buf->s.video.linesize[0]);
+        break;
+    }
+    trace_end(&span);
     SDL_RenderClear(ctx->renderer);
     SDL_RenderCopy(ctx->renderer, ctx->texture, NULL, &ctx->vp_rect);
+    trace_begin(&span, "present", buf->pts_ms);
     SDL_RenderPresent(ctx->renderer);
+    trace_end(&span);
 
     decode_release_video_buffer(ctx->common.demux_ctx, buf);
 
@@ -273,39 +434,6 @@ static ret_code_t seek_sdl(video_player_h h, seek_direction_t dir, int32_t seek)
     return L_OK;
 }
 
-static ret_code_t schedule_sdl(video_player_h h, media_buffer_t *buf)
-{
-    player_ctx_t *ctx = (player_ctx_t *)h;
-
-    if (ctx->common.first_pkt)
-    {
-        clock_gettime(CLOCK_MONOTONIC, &ctx->common.base_time);
-        ctx->common.first_pkt = 0;
-    }
-    else if (buf->pts_ms != AV_NOPTS_VALUE)
-    {
-        struct timespec curr_time;
-        int diff;
-
-        clock_gettime(CLOCK_MONOTONIC, &curr_time);
-        diff = util_time_diff(&curr_time, &ctx->common.base_time);
-        DBG_V("Current PTS=%lld time diff=%d\n", buf->pts_ms, diff);
-        if (diff > 0 && buf->pts_ms > diff)
-        {
-            diff = buf->pts_ms - diff;
-            if (diff > 5000)
-            {
-                DBG_W("The frame requests %d msec wait. Drop it and continue\n", diff);
-                decode_release_video_buffer(ctx->common.demux_ctx, buf);
-                return L_FAILED;
-            }
-            DBG_V("Going to sleep for %d ms\n", diff);
-            msleep_wait(ctx->common.sched, diff);
-        }
-    }
-    return L_OK;
-}
-
 static int pause_toggle_sdl(video_player_h h)
 {
     player_ctx_t *ctx = (player_ctx_t *)h;
@@ -384,6 +512,7 @@ ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *c
     }
     memset(ctx, 0, sizeof(player_ctx_t));
     ctx->common.demux_ctx = h;
+    ctx->common.clock = clock;
 
     if (devode_get_video_size(h, &ctx->width, &ctx->height))
     {
@@ -402,7 +531,6 @@ ret_code_t video_player_start(video_player_h *player_ctx, demux_ctx_h h, void *c
     ctx->common.draw_frame = draw_frame_sdl;
     ctx->common.pause = pause_toggle_sdl;
     ctx->common.seek = seek_sdl;
-    ctx->common.schedule = schedule_sdl;
     ctx->common.idle = idle_sdl;
 
     /* Use default scheduler. Set SCHED_RR or SCHED_FIFO request root access */